@@ -0,0 +1,247 @@
+#include "Analyzer.h"
+#include "Dispatch.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+AudioTap::AudioTap() {
+  ring.resize(TAP_BUFFER_SIZE);
+  mask = TAP_BUFFER_SIZE - 1;
+  written = 0;
+
+  generation = 0;
+  samplingrate = 0;
+  channel_count = 0;
+  byte_per_sample = 0;
+}
+
+void AudioTap::setFormat(uint32_t _samplingrate, uint32_t _channel_count, uint32_t _byte_per_sample) {
+  // Called before the stream starts, so the audio thread never sees a partial update
+  samplingrate.store(_samplingrate, std::memory_order_relaxed);
+  channel_count.store(_channel_count, std::memory_order_relaxed);
+  byte_per_sample.store(_byte_per_sample, std::memory_order_relaxed);
+  written.store(0, std::memory_order_relaxed);
+  generation.fetch_add(1, std::memory_order_release);
+}
+
+uint32_t AudioTap::getFormat(uint32_t &_samplingrate, uint32_t &_channel_count, uint32_t &_byte_per_sample) {
+  uint32_t gen = generation.load(std::memory_order_acquire);
+
+  _samplingrate = samplingrate.load(std::memory_order_relaxed);
+  _channel_count = channel_count.load(std::memory_order_relaxed);
+  _byte_per_sample = byte_per_sample.load(std::memory_order_relaxed);
+
+  return gen;
+}
+
+void AudioTap::push(const void *data, uint32_t length) {
+  uint64_t pos = written.load(std::memory_order_relaxed);
+  uint32_t offset = (uint32_t)(pos & mask);
+
+  if (length > ring.size()) {
+    data = (const char *)data + (length - ring.size());
+    pos += length - ring.size();
+    offset = (uint32_t)(pos & mask);
+    length = ring.size();
+  }
+
+  uint32_t first = std::min(length, (uint32_t)ring.size() - offset);
+
+  memcpy(ring.data() + offset, data, first);
+  if (first < length) {
+    memcpy(ring.data(), (const char *)data + first, length - first);
+  }
+
+  written.store(pos + length, std::memory_order_release);
+}
+
+uint32_t AudioTap::readLatest(char *dst, uint32_t length, uint64_t &position) {
+  uint64_t end = written.load(std::memory_order_acquire);
+
+  if (end < length || length > ring.size()) {
+    return 0;
+  }
+
+  uint64_t begin = end - length;
+  uint32_t offset = (uint32_t)(begin & mask);
+  uint32_t first = std::min(length, (uint32_t)ring.size() - offset);
+
+  memcpy(dst, ring.data() + offset, first);
+  if (first < length) {
+    memcpy(dst + first, ring.data(), length - first);
+  }
+
+  // Writer lapped us while copying, drop this read
+  if (written.load(std::memory_order_acquire) - begin > ring.size()) {
+    return 0;
+  }
+
+  position = end;
+
+  return length;
+}
+
+SpectrumAnalyzer::SpectrumAnalyzer() {
+  fft_size = 0;
+  window_gain = 1.f;
+
+  setSize(4096);
+}
+
+void SpectrumAnalyzer::setSize(uint32_t size) {
+  uint32_t bits = 0;
+
+  // Round down to power of two
+  while ((2u << bits) <= size) {
+    bits++;
+  }
+
+  size = 1u << bits;
+
+  if (size == fft_size) {
+    return;
+  }
+
+  fft_size = size;
+
+  // Hann window
+  window.resize(fft_size);
+  window_gain = 0.f;
+
+  for (uint32_t i = 0; i < fft_size; i++) {
+    window[i] = 0.5f - 0.5f * cosf(2 * 3.1415926f * i / fft_size);
+    window_gain += window[i];
+  }
+
+  // Bit reversal table
+  bitrev.resize(fft_size);
+
+  for (uint32_t i = 0; i < fft_size; i++) {
+    uint32_t r = 0;
+
+    for (uint32_t b = 0; b < bits; b++) {
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+
+    bitrev[i] = r;
+  }
+
+  // Twiddles stored contiguously per stage so butterflies run on unit stride
+  twiddle_re.resize(fft_size);
+  twiddle_im.resize(fft_size);
+
+  for (uint32_t half = 1, base = 0; half < fft_size; base += half, half <<= 1) {
+    for (uint32_t k = 0; k < half; k++) {
+      twiddle_re[base + k] = cosf(-3.1415926f * k / half);
+      twiddle_im[base + k] = sinf(-3.1415926f * k / half);
+    }
+  }
+
+  fft_re.resize(fft_size);
+  fft_im.resize(fft_size);
+  power.resize(fft_size / 2 + 1);
+}
+
+uint32_t SpectrumAnalyzer::getSize() {
+  return fft_size;
+}
+
+void SpectrumAnalyzer::transform() {
+  const KernelTable &kernels = Dispatch::kernels();
+  float *re = fft_re.data();
+  float *im = fft_im.data();
+
+  for (uint32_t half = 1, base = 0; half < fft_size; base += half, half <<= 1) {
+    const float *wr = twiddle_re.data() + base;
+    const float *wi = twiddle_im.data() + base;
+
+    for (uint32_t start = 0; start < fft_size; start += half * 2) {
+      kernels.butterfly(re + start, im + start, re + start + half, im + start + half, wr, wi, half);
+    }
+  }
+}
+
+void SpectrumAnalyzer::convertToMono(const char *src, float *dst, uint32_t frames, uint32_t channel, uint32_t samplesize) {
+  // 4 byte samples are float32
+  if (samplesize == 4) {
+    const float *in = (const float *)src;
+
+    for (uint32_t i = 0; i < frames; i++) {
+      float sum = 0.f;
+
+      for (uint32_t c = 0; c < channel; c++) {
+        sum += in[i * channel + c];
+      }
+
+      dst[i] = sum / channel;
+    }
+
+    return;
+  }
+
+  float scale = 1.f / (channel * (float)(1u << (samplesize * 8 - 1)));
+
+  for (uint32_t i = 0; i < frames; i++) {
+    int32_t sum = 0;
+
+    for (uint32_t c = 0; c < channel; c++) {
+      const unsigned char *p = (const unsigned char *)src + (i * channel + c) * samplesize;
+
+      switch (samplesize) {
+        case 1:
+          sum += (int32_t)p[0] - 0x80;
+          break;
+        case 2:
+          sum += (int16_t)(p[0] | (p[1] << 8));
+          break;
+        case 3:
+          sum += (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+          break;
+      }
+    }
+
+    dst[i] = sum * scale;
+  }
+}
+
+uint32_t SpectrumAnalyzer::analyze(const float *samples, uint32_t count, std::vector<float> &spectrum) {
+  uint32_t bins = fft_size / 2 + 1;
+  uint32_t hop = fft_size / 2;
+  uint32_t segments = 0;
+
+  std::fill(power.begin(), power.end(), 0.f);
+
+  // Welch average of 50% overlapped segments
+  for (uint32_t offset = 0; offset + fft_size <= count; offset += hop) {
+    for (uint32_t i = 0; i < fft_size; i++) {
+      fft_re[bitrev[i]] = samples[offset + i] * window[i];
+      fft_im[i] = 0.f;
+    }
+
+    transform();
+
+    for (uint32_t i = 0; i < bins; i++) {
+      power[i] += fft_re[i] * fft_re[i] + fft_im[i] * fft_im[i];
+    }
+
+    segments++;
+  }
+
+  spectrum.resize(bins);
+
+  if (segments == 0) {
+    std::fill(spectrum.begin(), spectrum.end(), -200.f);
+
+    return 0;
+  }
+
+  // Full scale sine reads 0 dBFS
+  float scale = 4.f / (window_gain * window_gain * segments);
+
+  for (uint32_t i = 0; i < bins; i++) {
+    spectrum[i] = 10.f * log10f(power[i] * scale + 1e-20f);
+  }
+
+  return segments;
+}
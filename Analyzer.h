@@ -0,0 +1,63 @@
+#pragma once
+
+#ifndef _ANALYZER_H_
+#define _ANALYZER_H_
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+#define TAP_BUFFER_SIZE         (1 << 22)   // bytes, must be power of two
+#define SPECTRUM_AVERAGE_COUNT  8           // Welch segments per spectrum
+
+// Single-producer ring which receives every block handed to the output device.
+// The audio thread only copies into it and never waits for the reader, older
+// data is simply overwritten.
+class AudioTap {
+  private:
+    std::vector<char> ring;
+    uint64_t mask;
+    std::atomic<uint64_t> written;
+
+    std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> samplingrate;
+    std::atomic<uint32_t> channel_count;
+    std::atomic<uint32_t> byte_per_sample;
+
+  public:
+    AudioTap();
+
+    void setFormat(uint32_t, uint32_t, uint32_t);
+    uint32_t getFormat(uint32_t &, uint32_t &, uint32_t &);
+
+    void push(const void *, uint32_t);
+    uint32_t readLatest(char *, uint32_t, uint64_t &);
+};
+
+class SpectrumAnalyzer {
+  private:
+    uint32_t fft_size;
+    float window_gain;
+
+    std::vector<float> window;
+    std::vector<float> twiddle_re;
+    std::vector<float> twiddle_im;
+    std::vector<uint32_t> bitrev;
+
+    std::vector<float> fft_re;
+    std::vector<float> fft_im;
+    std::vector<float> power;
+
+    void transform();
+
+  public:
+    SpectrumAnalyzer();
+
+    void setSize(uint32_t);
+    uint32_t getSize();
+
+    static void convertToMono(const char *, float *, uint32_t, uint32_t, uint32_t);
+    uint32_t analyze(const float *, uint32_t, std::vector<float> &);
+};
+
+#endif
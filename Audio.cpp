@@ -1,17 +1,125 @@
 #include "Audio.h"
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 AudioSystem::AudioSystem() {
-  Pa_Initialize();
+  // Bind DSP kernels before anything touches audio
+  Dispatch::init();
+
   av_register_all();
 
   srand(time(NULL));
+
+  backend = NULL;
+  bReady = false;
+  default_device = paNoDevice;
+  starter = std::thread(&AudioSystem::starterMain, this);
+
+  bReaperExit = false;
+  reaper = std::thread(&AudioSystem::reaperMain, this);
 }
 
 AudioSystem::~AudioSystem() {
-  Pa_Terminate();
+  starter.join();
+
+  {
+    std::lock_guard<std::mutex> guard(reaper_lock);
+
+    bReaperExit = true;
+  }
+
+  // Remaining jobs are finished before the thread exits
+  reaper_cond.notify_all();
+  reaper.join();
+
+  delete backend;
+}
+
+void AudioSystem::reaperMain() {
+  Trace::setThreadName("reaper");
+
+  std::unique_lock<std::mutex> guard(reaper_lock);
+
+  while (true) {
+    reaper_cond.wait(guard, [&]() { return bReaperExit || !reaper_jobs.empty(); });
+
+    if (reaper_jobs.empty()) {
+      break;
+    }
+
+    std::function<void()> job = std::move(reaper_jobs.front());
+    reaper_jobs.pop_front();
+
+    guard.unlock();
+    job();
+    guard.lock();
+  }
+}
+
+void AudioSystem::starterMain() {
+  TRACE_SCOPE("backend init");
+  Trace::setThreadName("audio init");
+
+  // PortAudio only needs its calls not to overlap, so initializing here and
+  // using it from the UI thread afterwards is fine
+  AudioBackend *created = AudioBackend::create();
+  std::vector<OutputDevice> devices;
+
+  created->getOutputDevices(devices);
+
+  {
+    std::lock_guard<std::mutex> guard(ready_lock);
+
+    backend = created;
+    default_device = created->getDefaultDevice();
+    output_devices = std::move(devices);
+    bReady = true;
+  }
+
+  ready_cond.notify_all();
+}
+
+void AudioSystem::waitReady() {
+  if (!bReady) {
+    std::unique_lock<std::mutex> guard(ready_lock);
+
+    ready_cond.wait(guard, [&]() { return bReady.load(); });
+  }
+}
+
+bool AudioSystem::isReady() {
+  return bReady;
 }
 
-bool AudioSystem::getInfo(std::string &path, uint32_t &samplingrate, uint8_t &bitdepth) {
+void AudioSystem::defer(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> guard(reaper_lock);
+
+    reaper_jobs.push_back(std::move(job));
+  }
+
+  reaper_cond.notify_one();
+}
+
+void AudioSystem::releaseSession(SongSession *session) {
+  if (session) {
+    defer([session]() {
+      delete session;
+    });
+  }
+}
+
+void AudioSystem::closeStream(AudioStream *stream, PlaybackState *state) {
+  defer([stream, state]() {
+    delete stream;
+    delete state;
+  });
+}
+
+bool AudioSystem::getInfo(std::string &path, uint32_t &samplingrate, uint8_t &bitdepth, uint32_t &duration) {
+  TRACE_SCOPE("getInfo");
   AVFormatContext *avf_context;
   bool result;
 
@@ -34,6 +142,7 @@ bool AudioSystem::getInfo(std::string &path, uint32_t &samplingrate, uint8_t &bi
       if (audio_id != UINT_MAX) {
         samplingrate = (uint32_t)avf_context->streams[audio_id]->codecpar->sample_rate;
         bitdepth = (uint8_t)avf_context->streams[audio_id]->codecpar->bits_per_raw_sample;
+        duration = avf_context->duration > 0 ? (uint32_t)(avf_context->duration / (AV_TIME_BASE / 1000)) : 0;
       }
       else {
         result = false;
@@ -47,17 +156,102 @@ bool AudioSystem::getInfo(std::string &path, uint32_t &samplingrate, uint8_t &bi
   return result;
 }
 
-SongSession::SongSession(AudioSystem *_pSystem) {
+StimulusStore *AudioSystem::getStore() {
+  return &store;
+}
+
+AudioBackend *AudioSystem::getBackend() {
+  waitReady();
+
+  return backend;
+}
+
+PaDeviceIndex AudioSystem::getDefaultDevice() {
+  waitReady();
+
+  return default_device;
+}
+
+void AudioSystem::getOutputDevices(std::vector<OutputDevice> &devices) {
+  waitReady();
+
+  // Enumerated once, device lists are fixed after Pa_Initialize anyway
+  devices = output_devices;
+}
+
+bool AudioSystem::negotiateFormat(PaDeviceIndex device, uint32_t channel_count, uint32_t preferred_rate, DeviceFormat &format) {
+  waitReady();
+
+  std::lock_guard<std::mutex> guard(device_lock);
+
+  if (device == paNoDevice) {
+    device = default_device;
+  }
+
+  auto key = std::make_tuple(device, channel_count, preferred_rate);
+  auto iter = device_formats.find(key);
+
+  if (iter != device_formats.end()) {
+    format = iter->second;
+
+    return true;
+  }
+
+  if (device == paNoDevice) {
+    return false;
+  }
+
+  double latency = backend->getDefaultLatency(device);
+
+  // Stimulus rate first so HQ plays untouched, then whatever the device runs at
+  uint32_t rates[] = { preferred_rate, (uint32_t)backend->getDefaultSampleRate(device), 192000, 96000, 48000, 44100 };
+
+  // Low bitdepth stimuli are carried exactly in any of these
+  PaSampleFormat formats[] = { paInt24, paInt32, paFloat32 };
+  uint32_t sizes[] = { 3, 4, 4 };
+
+  for (auto rate : rates) {
+    for (int i = 0; i < 3; i++) {
+      PaStreamParameters param;
+
+      memset(&param, 0, sizeof(PaStreamParameters));
+      param.device = device;
+      param.channelCount = channel_count;
+      param.sampleFormat = formats[i];
+      param.suggestedLatency = latency;
+
+      if (backend->isFormatSupported(param, rate)) {
+        format = { device, rate, channel_count, formats[i], sizes[i], latency };
+        device_formats[key] = format;
+
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+SongSession::SongSession(AudioSystem *_pSystem, AudioTap *_pTap, PaDeviceIndex _output_device) {
   pSystem = _pSystem;
+  pTap = _pTap;
+  output_device = _output_device;
 
   avf_context = NULL;
   current_stream = NULL;
+  playback = NULL;
+  bRealtime = false;
+  reported_misses = 0;
   stream_id = UINT_MAX;
   current_freq = 0;
-  audio_index = 0;
+  current_source = STIMULUS_NONE;
   bitdepth = 0;
   samplingrate = 0;
   channel_count = 0;
+  excerpt_start = 0;
+  excerpt_end = 0;
+  hash_hq = 0;
+  hash_lq = 0;
 }
 
 SongSession::~SongSession() {
@@ -65,10 +259,8 @@ SongSession::~SongSession() {
     avformat_close_input(&avf_context);
     avformat_free_context(avf_context);
   }
-  if (current_stream) {
-    Pa_StopStream(current_stream);
-    Pa_CloseStream(current_stream);
-  }
+  delete current_stream;
+  delete playback;
 }
 
 void SongSession::getTestTypes(std::vector<std::string> &data) {
@@ -90,8 +282,11 @@ void SongSession::getHQFactors(std::vector<std::string> &data) {
     }
   }
   else {
-    data.push_back("24");
-    data.push_back("16");
+    for (uint32_t i = 24; i >= 16; i -= 8) {
+      if (i <= bitdepth) {
+        data.push_back(std::to_string(i));
+      }
+    }
   }
 }
 
@@ -106,8 +301,11 @@ void SongSession::getLQFactors(std::vector<std::string> &data) {
     }
   }
   else {
-    data.push_back("16");
-    data.push_back("8");
+    for (uint32_t i = 16; i >= 8; i -= 8) {
+      if (i < bitdepth) {
+        data.push_back(std::to_string(i));
+      }
+    }
   }
 }
 
@@ -141,43 +339,61 @@ bool SongSession::setTestInfo(std::string hqFactor, std::string lqFactor) {
 
 void SongSession::sineWaveTest(int targetFrequency) {
   int time = 2;
-  
-  // Create sine wave (1sec)
-  current_freq = 192000;
+
+  if (!pSystem->negotiateFormat(output_device, 1, 192000, device)) {
+    return;
+  }
+
+  // Create sine wave at the device rate, 16bit resolution
+  current_freq = device.samplingrate;
   memset(&spec, 0, sizeof(PaStreamParameters));
-  spec.device = Pa_GetDefaultOutputDevice();
+  spec.device = device.device;
   spec.channelCount = 1;
-  spec.suggestedLatency = Pa_GetDeviceInfo(spec.device)->defaultLowOutputLatency;
-  spec.sampleFormat = paInt16;
-  current_data = &data_original;
-  byte_per_sample = 2;
-  uint32_t length = current_freq * spec.channelCount * byte_per_sample;
-  uint32_t buffersize = length / 10;
-  
-  length *= time;
+  spec.suggestedLatency = device.latency;
+  spec.sampleFormat = device.sample_format;
+  uint32_t count = current_freq * time;
+  uint32_t buffersize = current_freq / 10;
 
   // Create buffer
-  data_original.resize(length);
+  std::string wave;
+
+  wave.resize(count * sizeof(float));
 
-  for (uint32_t i = 0; i < length; i += byte_per_sample) {
-    int16_t sample = 0x7FFF * cosf(2 * 3.1415926f * targetFrequency * i / byte_per_sample / current_freq);
-    
-    memcpy((char *)data_original.c_str() + i, &sample, byte_per_sample);
+  for (uint32_t i = 0; i < count; i++) {
+    ((float *)wave.c_str())[i] = 32767.f / 32768.f * cosf(2 * 3.1415926f * targetFrequency * i / current_freq);
   }
 
+  playback = createPlayback();
+  setSource(playback, STIMULUS_HQ, CompressedPCM::encode(PCMBuffer(std::move(wave), { current_freq, 1, 16 })));
+  playback->requested = STIMULUS_HQ;
+  playback->bPaused = false;
+
+  pTap->setFormat(current_freq, spec.channelCount, sizeof(float));
+
   // Play sinewave for 1 sec
-  if (Pa_OpenStream(&current_stream, NULL, &spec, current_freq, buffersize, paClipOff, fill_audio, this) == paNoError) {
-    Pa_StartStream(current_stream);
-    Pa_Sleep(1000 * time);
-    Pa_StopStream(current_stream);
-    Pa_CloseStream(current_stream);
+  current_stream = pSystem->getBackend()->openStream(spec, current_freq, buffersize, fill_audio, playback);
+
+  if (current_stream) {
+    current_stream->start();
+    std::this_thread::sleep_for(std::chrono::seconds(time));
+    delete current_stream;
     current_stream = NULL;
   }
+
+  delete playback;
+  playback = NULL;
+  current_freq = 0;
 }
 
 bool SongSession::openSound(const char *filepath) {
+  TRACE_SCOPE("openSound");
   bool result;
 
+  path = filepath;
+
+  // Drawn here on the UI thread, readSound may run on a worker
+  bFirstSoundIsBetter = rand() % 2;
+
   avf_context = avformat_alloc_context();
   result = avformat_open_input(&avf_context, filepath, NULL, NULL) >= 0;
 
@@ -194,7 +410,7 @@ bool SongSession::openSound(const char *filepath) {
 
       if (stream_id != UINT_MAX) {
         samplingrate = (uint32_t)avf_context->streams[stream_id]->codecpar->sample_rate;
-        bitdepth = (uint32_t)avf_context->streams[stream_id]->codecpar->bits_per_raw_sample;
+        bitdepth = getResolution(avf_context->streams[stream_id]->codecpar);
         channel_count = (uint32_t)avf_context->streams[stream_id]->codecpar->channels;
       }
       else {
@@ -206,127 +422,584 @@ bool SongSession::openSound(const char *filepath) {
   return result;
 }
 
-bool SongSession::readSound() {
-  bool result = false;
+void SongSession::setExcerpt(uint32_t start, uint32_t end) {
+  excerpt_start = start;
+  excerpt_end = end > start ? end : 0;
+}
 
-  if (avf_context && bitdepth == 24) {
-    AVPacket packet;
-    AVFrame *frame;
-    AVCodecParameters *cpar;
-    AVCodecContext *ctx;
-    AVCodec *codec;
-    std::string buffer;
+uint32_t SongSession::getResolution(const AVCodecParameters *cpar) {
+  uint32_t bits = (uint32_t)cpar->bits_per_raw_sample;
 
-    buffer.resize(MAX_AUDIO_FRAME_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
+  // Quantization works on a 24bit grid, float and 32bit sources are held to it
+  if (bits == 0) {
+    switch (cpar->format) {
+      case AV_SAMPLE_FMT_U8:
+      case AV_SAMPLE_FMT_U8P:
+        bits = 8;
+        break;
+      case AV_SAMPLE_FMT_S16:
+      case AV_SAMPLE_FMT_S16P:
+        bits = 16;
+        break;
+      default:
+        bits = 24;
+        break;
+    }
+  }
 
-    cpar = avf_context->streams[stream_id]->codecpar;
-    ctx = avcodec_alloc_context3(NULL);
+  return FFMIN(bits, 24);
+}
 
-    if (ctx == NULL) {
-      goto READ_SOUND_CLEANUP;
-    }
+Convert::InputFunc SongSession::getInput(AVSampleFormat format, uint32_t channel) {
+  bool bPlanar = av_sample_fmt_is_planar(format) != 0;
+
+  switch (format) {
+    case AV_SAMPLE_FMT_U8:
+    case AV_SAMPLE_FMT_U8P:
+      return Convert::getInput(SAMPLE_U8, bPlanar, channel);
+    case AV_SAMPLE_FMT_S16:
+    case AV_SAMPLE_FMT_S16P:
+      return Convert::getInput(SAMPLE_S16, bPlanar, channel);
+    case AV_SAMPLE_FMT_S32:
+    case AV_SAMPLE_FMT_S32P:
+      return Convert::getInput(SAMPLE_S32, bPlanar, channel);
+    case AV_SAMPLE_FMT_FLT:
+    case AV_SAMPLE_FMT_FLTP:
+      return Convert::getInput(SAMPLE_F32, bPlanar, channel);
+    case AV_SAMPLE_FMT_DBL:
+    case AV_SAMPLE_FMT_DBLP:
+      return Convert::getInput(SAMPLE_F64, bPlanar, channel);
+    default:
+      return NULL;
+  }
+}
 
-    if (avcodec_parameters_to_context(ctx, cpar) < 0) {
-      avcodec_free_context(&ctx);
-      goto READ_SOUND_CLEANUP;
-    }
+static int readDecodeMode() {
+  const char *env = getenv(DECODE_ENV);
 
-    codec = avcodec_find_decoder(ctx->codec_id);
+  if (env && strcmp(env, "serial") == 0) {
+    return DECODE_SERIAL;
+  }
+  else if (env && strcmp(env, "verify") == 0) {
+    return DECODE_VERIFY;
+  }
 
-    if (codec == NULL) {
-      avcodec_free_context(&ctx);
-      goto READ_SOUND_CLEANUP;
-    }
+  return DECODE_PARALLEL;
+}
+
+static int getDecodeMode() {
+  static const int mode = readDecodeMode();   // stations may ask at once
+
+  return mode;
+}
+
+bool SongSession::isSegmentable(const AVCodecParameters *cpar) {
+  // Seeking has to be sample exact and every frame independent, which holds
+  // for FLAC and plain PCM. Listed one by one, the PCM id range also holds
+  // companded and bit-packed formats.
+  switch (cpar->codec_id) {
+    case AV_CODEC_ID_FLAC:
+    case AV_CODEC_ID_PCM_S16LE:
+    case AV_CODEC_ID_PCM_S16BE:
+    case AV_CODEC_ID_PCM_S24LE:
+    case AV_CODEC_ID_PCM_S24BE:
+    case AV_CODEC_ID_PCM_S32LE:
+    case AV_CODEC_ID_PCM_S32BE:
+    case AV_CODEC_ID_PCM_F32LE:
+    case AV_CODEC_ID_PCM_F32BE:
+    case AV_CODEC_ID_PCM_F64LE:
+    case AV_CODEC_ID_PCM_F64BE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool SongSession::decodeRange(AVFormatContext *context, uint32_t stream_id, uint32_t channel_count, uint64_t first, uint64_t last, bool bThreaded, const DecodeSink &sink) {
+  TRACE_SCOPE("decode");
+  AVStream *stream = context->streams[stream_id];
+  AVCodecParameters *cpar = stream->codecpar;
+  AVCodecContext *ctx;
+  AVCodec *codec;
+  AVPacket *packet;
+  AVFrame *frame;
+  Convert::InputFunc input;
+  std::vector<float> block;
+  uint64_t position = 0;
+  int64_t origin = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+  AVRational frame_base = { 1, cpar->sample_rate };
+  int error = 0;
+  bool bEOF = false;
+  bool bSeeked = false;
+
+  ctx = avcodec_alloc_context3(NULL);
+
+  if (ctx == NULL) {
+    return false;
+  }
+
+  if (avcodec_parameters_to_context(ctx, cpar) < 0) {
+    avcodec_free_context(&ctx);
+    return false;
+  }
 
-    if (avcodec_open2(ctx, codec, NULL) < 0) {
-      avcodec_free_context(&ctx);
-      goto READ_SOUND_CLEANUP;
+  codec = avcodec_find_decoder(ctx->codec_id);
+
+  if (codec == NULL) {
+    avcodec_free_context(&ctx);
+    return false;
+  }
+
+  // FLAC and ALAC decode independent frames in parallel, 0 lets libavcodec pick the count
+  if (bThreaded && (codec->capabilities & (AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_SLICE_THREADS))) {
+    ctx->thread_count = 0;
+    ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  }
+
+  if (avcodec_open2(ctx, codec, NULL) < 0) {
+    avcodec_free_context(&ctx);
+    return false;
+  }
+
+  // Output format of the decoder is only known once it is open
+  input = getInput(ctx->sample_fmt, channel_count);
+
+  if (input == NULL) {
+    avcodec_close(ctx);
+    avcodec_free_context(&ctx);
+    return false;
+  }
+
+  packet = av_packet_alloc();
+  frame = av_frame_alloc();
+
+  // Seek lands on a packet somewhat before the range, the pre-roll gives the
+  // decoder history to settle on and is dropped with the rest before it
+  if (first > 0) {
+    uint64_t preroll = (uint64_t)DECODE_PREROLL_MS * cpar->sample_rate / 1000;
+    int64_t target = av_rescale_q((int64_t)(first > preroll ? first - preroll : 0), frame_base, stream->time_base) + origin;
+
+    if (av_seek_frame(context, stream_id, target, AVSEEK_FLAG_BACKWARD) >= 0) {
+      avcodec_flush_buffers(ctx);
+      bSeeked = true;
     }
+  }
 
-    frame = av_frame_alloc();
+  // A packet may produce any number of frames and a threaded decoder holds
+  // some back, so every send is drained and end of stream sends a flush
+  while (!bEOF && error >= 0) {
+    if (av_read_frame(context, packet) < 0) {
+      bEOF = true;
+      error = avcodec_send_packet(ctx, NULL);
+    }
+    else if ((uint32_t)packet->stream_index == stream_id) {
+      error = avcodec_send_packet(ctx, packet);
+      av_packet_unref(packet);  // av_read_frame
+    }
+    else {
+      av_packet_unref(packet);  // av_read_frame
+      continue;
+    }
 
-    packet.data = (uint8_t *)buffer.c_str();
-    packet.size = buffer.size();
-      
-    int len;
-    int frame_ptr;
-    while (true) {
-      av_init_packet(&packet);
+    while (error >= 0) {
+      error = avcodec_receive_frame(ctx, frame);
 
-      if (av_read_frame(avf_context, &packet) < 0) {
+      if (error < 0) {
         break;
       }
 
-      if ((uint32_t)packet.stream_index == stream_id) {
-        frame_ptr = 0;
+      // Without a timestamp on the first frame there is no telling where the
+      // seek landed, so the range is counted from the start of the stream
+      if (bSeeked) {
+        bSeeked = false;
 
-        if (avcodec_send_packet(ctx, &packet) < 0) {
-          break;
-        }
+        if (frame->best_effort_timestamp == AV_NOPTS_VALUE) {
+          av_frame_unref(frame);    // avcodec_receive_frame
 
-        len = avcodec_receive_frame(ctx, frame);
+          error = av_seek_frame(context, stream_id, origin, AVSEEK_FLAG_BACKWARD);
+
+          if (error >= 0) {
+            avcodec_flush_buffers(ctx);
+            bEOF = false;
+            error = AVERROR(EAGAIN);
+          }
 
-        if (len < 0 && len != AVERROR(EAGAIN) && len != AVERROR_EOF) {
           break;
         }
-        if (len >= 0) {
-          frame_ptr = 1;
-        }
+      }
 
-        if (frame_ptr) {
-          // libavcodec provide 32bit sample for 24bit audio
-          int sample_size = frame->linesize[0] / 4;
-          int beginidx = data_original.size();
-          data_original.append(sample_size * 3, NULL);
+      // After a seek only timestamps tell where decoding is, a whole file is
+      // just counted so nothing is ever dropped
+      if ((first > 0 || last != UINT64_MAX) && frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+        position = (uint64_t)FFMAX(av_rescale_q(frame->best_effort_timestamp - origin, stream->time_base, frame_base), (int64_t)0);
+      }
 
-          for (int i = 0; i < sample_size; i++) {
-            memcpy((char *)data_original.c_str() + beginidx + i * 3, frame->extended_data[0] + i * 4 + 1, 3);
-          }
-        }
+      uint64_t begin = FFMAX(position, first);
+      uint64_t end = FFMIN(position + frame->nb_samples, last);
+
+      // Converted while still in cache, then handed on
+      if (end > begin) {
+        block.resize((size_t)frame->nb_samples * channel_count);
+        input(frame->extended_data, block.data(), frame->nb_samples, channel_count);
+
+        sink(block.data() + (size_t)(begin - position) * channel_count, (uint32_t)(end - begin));
+      }
 
-        av_frame_unref(frame);  // av_read_frame
+      position += frame->nb_samples;
+
+      av_frame_unref(frame);    // avcodec_receive_frame
+
+      // Rest of the file is never read
+      if (position >= last) {
+        bEOF = true;
+        break;
       }
+    }
 
-      av_packet_unref(&packet); // av_init_packet
+    // Decoder wants the next packet, or is fully flushed
+    if (error == AVERROR(EAGAIN) || error == AVERROR_EOF) {
+      error = 0;
     }
+  }
 
-    av_frame_free(&frame);      // av_frame_alloc
-    avcodec_close(ctx);         // avcodec_open2
-    avcodec_free_context(&ctx); // avcodec_alloc_context3
+  av_frame_free(&frame);      // av_frame_alloc
+  av_packet_free(&packet);    // av_packet_alloc
+  avcodec_close(ctx);         // avcodec_open2
+  avcodec_free_context(&ctx); // avcodec_alloc_context3
 
-    // Make data_hq and data_lq
-    bFirstSoundIsBetter = rand() % 2;
+  // A hard error leaves the range short, nothing partial is played
+  return error >= 0;
+}
 
-    if (bTestingSamplerate) {
-      if (uiFactorHQ != samplingrate) {
-        convertSamplingRate(data_original, data_hq, samplingrate, uiFactorHQ, channel_count);
+bool SongSession::decodeSegments(AVFormatContext *context, const std::string &path, uint32_t stream_id, uint32_t channel_count, uint64_t first, uint64_t last, uint64_t end, uint32_t count, const DecodeSink &sink) {
+  ThreadPool &pool = ThreadPool::getInstance();
+  std::vector<TaskGroup> groups(count);
+  std::vector<std::vector<float>> outputs(count);
+  std::vector<char> results(count, 0);
+  uint32_t window = pool.getThreadCount() + 1;
+  uint32_t next = 0;
+  bool result = true;
+  bool bFallback = false;
+
+  // Last segment runs to the end of the range, the duration is only a guess
+  auto boundary = [=](uint32_t k) {
+    return k == count ? last : first + (end - first) * k / count;
+  };
+
+  // Each segment has its own demuxer and decoder, only the header is read
+  // to open them since the formats split here need no probing
+  auto submit = [&](uint32_t k) {
+    pool.run(groups[k], [&, k]() {
+      TRACE_SCOPE("decode segment");
+      AVFormatContext *segment = avformat_alloc_context();
+      std::vector<float> &output = outputs[k];
+
+      output.reserve((size_t)(FFMIN(boundary(k + 1), end) - boundary(k)) * channel_count);
+
+      if (avformat_open_input(&segment, path.c_str(), NULL, NULL) >= 0) {
+        results[k] = decodeRange(segment, stream_id, channel_count, boundary(k), boundary(k + 1), false, [&](const float *samples, uint32_t frames) {
+          output.insert(output.end(), samples, samples + (size_t)frames * channel_count);
+        });
+
+        avformat_close_input(&segment);   // avformat_open_input
+      }
+    });
+  };
+
+  // Only a window of segments is in flight so memory stays bounded
+  for (; next < FFMIN(window, count); next++) {
+    submit(next);
+  }
+
+  for (uint32_t k = 0; k < count; k++) {
+    pool.wait(groups[k]);
+
+    if (!bFallback) {
+      std::vector<float> &output = outputs[k];
+      uint64_t frames = output.size() / channel_count;
+
+      // Every segment but the last has to fill its range exactly, a seek that
+      // landed late would otherwise leave a gap nobody notices
+      if (results[k] && (k == count - 1 || frames == boundary(k + 1) - boundary(k))) {
+        for (uint64_t done = 0; done < frames; done += RENDER_BLOCK_FRAMES) {
+          sink(output.data() + (size_t)done * channel_count, (uint32_t)FFMIN(frames - done, (uint64_t)RENDER_BLOCK_FRAMES));
+        }
       }
       else {
-        data_hq = data_original;
+        // Segment failed or came out short, the rest is decoded here in order
+        bFallback = true;
+        result = decodeRange(context, stream_id, channel_count, boundary(k), last, true, sink);
       }
+    }
+
+    std::vector<float>().swap(outputs[k]);
 
-      convertSamplingRate(data_original, data_lq, samplingrate, uiFactorLQ, channel_count);
+    if (!bFallback && next < count) {
+      submit(next++);
+    }
+  }
+
+  return result;
+}
+
+uint64_t SongSession::hashStimulus(const CompressedPCM &data) {
+  TRACE_SCOPE("hash stimulus");
+  XXHash64 state;
+  uint32_t channel = data.getFormat().channel_count;
+  std::vector<float> block((size_t)CODEC_BLOCK_FRAMES * channel);
+
+  // The samples as stored, so a play-through from the ring hashes the same.
+  // The codec keeps every value but not the sign of zero.
+  for (uint64_t b = 0; b < data.getBlockCount(); b++) {
+    uint32_t frames = data.decode(b, block.data());
+
+    state.update(block.data(), (size_t)frames * channel * sizeof(float));
+  }
+
+  return state.digest();
+}
+
+std::string SongSession::verifyDecode(const std::string &path, uint32_t stream_id, uint64_t first, uint64_t last, uint32_t segments, const PCMBuffer &decoded) {
+  TRACE_SCOPE("verify decode");
+  AVFormatContext *context = avformat_alloc_context();
+  uint32_t channel_count = decoded.getFormat().channel_count;
+  std::vector<float> reference;
+  uint64_t mismatch = UINT64_MAX;
+  std::string report;
+
+  if (avformat_open_input(&context, path.c_str(), NULL, NULL) < 0) {
+    return report.append("Decode verify: cannot open ").append(path).append("\n");
+  }
+
+  decodeRange(context, stream_id, channel_count, first, last, true, [&](const float *samples, uint32_t frames) {
+    reference.insert(reference.end(), samples, samples + (size_t)frames * channel_count);
+  });
+
+  avformat_close_input(&context);   // avformat_open_input
+
+  uint64_t frames = reference.size() / channel_count;
+  uint64_t common = FFMIN(frames, decoded.getFrameCount());
+
+  // Compared as bits, a segment off by one sample shows up right at its start
+  for (uint64_t i = 0; i < common && mismatch == UINT64_MAX; ) {
+    uint64_t available;
+    const float *samples = decoded.getFrames(i, available);
+    uint64_t length = FFMIN(available, common - i);
+
+    for (uint64_t j = 0; j < length; j++) {
+      if (memcmp(samples + j * channel_count, reference.data() + (i + j) * channel_count, channel_count * sizeof(float)) != 0) {
+        mismatch = i + j;
+        break;
+      }
+    }
+
+    i += length;
+  }
+
+  if (mismatch == UINT64_MAX && frames != decoded.getFrameCount()) {
+    mismatch = common;
+  }
+
+  report.append("Decode verify: ").append(std::to_string(segments)).append(" segments, ").append(std::to_string(decoded.getFrameCount())).append(" frames");
+
+  if (mismatch == UINT64_MAX) {
+    report.append(", bit-exact\n");
+  }
+  else {
+    report.append(", differs from frame ").append(std::to_string(mismatch)).append(" (serial decode has ").append(std::to_string(frames)).append(" frames)\n");
+
+    // Marked in the trace too, next to the segments that produced it
+    if (Trace::isEnabled()) {
+      uint64_t now = Trace::now();
+
+      Trace::record("decode mismatch", now, now);
+    }
+  }
+
+  return report;
+}
+
+bool SongSession::readSound() {
+  TRACE_SCOPE("readSound");
+  StimulusKey key = { path, bTestingSamplerate, uiFactorHQ, uiFactorLQ, excerpt_start, excerpt_end, 0, 0 };
+
+  key.stamp();
+
+  // Another station may have prepared this song with the same factors already
+  stimulus = pSystem->getStore()->acquire(key, [&]() -> std::shared_ptr<const Stimulus> {
+    if (!prepareSound()) {
+      return nullptr;
+    }
+
+    std::shared_ptr<Stimulus> result = std::make_shared<Stimulus>();
+    TaskGroup encode_hq;
+
+    // Kept compressed, the plain renders are dropped right after
+    ThreadPool::getInstance().run(encode_hq, [&]() {
+      result->hq = CompressedPCM::encode(data_hq);
+      result->hash_hq = hashStimulus(result->hq);
+    });
+
+    result->lq = CompressedPCM::encode(data_lq);
+    result->hash_lq = hashStimulus(result->lq);
+    ThreadPool::getInstance().wait(encode_hq);
+
+    data_hq.reset();
+    data_lq.reset();
+    result->loudness_hq = loudness_hq;
+    result->loudness_lq = loudness_lq;
+    result->truepeak_hq = truepeak_hq;
+    result->truepeak_lq = truepeak_lq;
+
+    return result;
+  });
+
+  if (avf_context) {
+    avformat_close_input(&avf_context);   // avformat_open_input
+    avformat_free_context(avf_context);   // avformat_alloc_context
+  }
+
+  if (!stimulus) {
+    return false;
+  }
+
+  loudness_hq = stimulus->loudness_hq;
+  loudness_lq = stimulus->loudness_lq;
+  truepeak_hq = stimulus->truepeak_hq;
+  truepeak_lq = stimulus->truepeak_lq;
+  hash_hq = stimulus->hash_hq;
+  hash_lq = stimulus->hash_lq;
+
+  return true;
+}
+
+bool SongSession::prepareSound() {
+  TRACE_SCOPE("prepareSound");
+  bool result = false;
+
+  if (avf_context && bitdepth >= 8) {
+    std::vector<float> scratch;
+    uint64_t decoded_frames = 0;
+
+    // Reserve the whole track (or excerpt) up front from the stream duration
+    AVStream *stream = avf_context->streams[stream_id];
+    double duration = stream->duration != AV_NOPTS_VALUE ? stream->duration * av_q2d(stream->time_base) : (double)avf_context->duration / AV_TIME_BASE;
+    uint64_t total = (uint64_t)(FFMAX(duration, 0.0) * samplingrate);
+    uint64_t expected = (uint64_t)(total * 1.01);
+
+    // Source frames kept, everything without an excerpt
+    uint64_t first_frame = (uint64_t)excerpt_start * samplingrate / 1000;
+    uint64_t last_frame = excerpt_end ? (uint64_t)excerpt_end * samplingrate / 1000 : UINT64_MAX;
+
+    expected = FFMIN(expected, last_frame) - FFMIN(expected, first_frame);
+
+    PCMWriter decoded({ samplingrate, channel_count, bitdepth }, expected);
+
+    // Loudness of both stimuli is predicted while decoding so gain is known before conversion
+    if (bTestingSamplerate) {
+      meter_hq.reset(uiFactorHQ, channel_count);
+      meter_lq.reset(uiFactorLQ, channel_count);
     }
     else {
-      if (uiFactorHQ != bitdepth) {
-        convertBitdepth(data_original, data_hq, bitdepth, uiFactorHQ);
+      meter_hq.reset(samplingrate, channel_count);
+      meter_lq.reset(samplingrate, channel_count);
+    }
+
+    // Frames reach the meters and the writer in order, however they were decoded
+    DecodeSink sink = [&](const float *samples, uint32_t frames) {
+      predictLoudness(samples, frames, decoded_frames, scratch);
+      decoded.append(samples, frames);
+      decoded_frames += frames;
+    };
+
+    // Long lossless files are split in segments decoded side by side
+    int mode = getDecodeMode();
+    uint64_t end_frame = FFMIN(total, last_frame);
+    uint32_t segments = 1;
+
+    if (mode != DECODE_SERIAL && isSegmentable(stream->codecpar) && end_frame > first_frame) {
+      segments = (uint32_t)FFMAX((end_frame - first_frame) / ((uint64_t)DECODE_SEGMENT_SECONDS * samplingrate), (uint64_t)1);
+    }
+
+    if (segments > 1) {
+      if (!decodeSegments(avf_context, path, stream_id, channel_count, first_frame, last_frame, end_frame, segments, sink)) {
+        return false;
       }
-      else {
-        data_hq = data_original;
+    }
+    else if (!decodeRange(avf_context, stream_id, channel_count, first_frame, last_frame, true, sink)) {
+      return false;
+    }
+
+    data_original = decoded.finish();
+
+    if (segments > 1 && mode == DECODE_VERIFY) {
+      decode_report.append(verifyDecode(path, stream_id, first_frame, last_frame, segments, data_original));
+    }
+
+    // Attenuate the louder stimulus so both match, never boost
+    double gain_hq = 0.0;
+    double gain_lq = 0.0;
+
+    loudness_hq = meter_hq.getIntegrated();
+    loudness_lq = meter_lq.getIntegrated();
+
+    if (loudness_hq > LOUDNESS_SILENCE && loudness_lq > LOUDNESS_SILENCE) {
+      gain_hq = FFMIN(loudness_lq - loudness_hq, 0.0);
+      gain_lq = FFMIN(loudness_hq - loudness_lq, 0.0);
+    }
+
+    // HQ renders on the pool while this thread renders LQ, both split their
+    // blocks across the same workers
+    TaskGroup render_hq;
+
+    if (gain_hq == 0.0 && uiFactorHQ == (bTestingSamplerate ? samplingrate : bitdepth)) {
+      data_hq = data_original;   // shares storage, no copy
+    }
+    else {
+      ThreadPool::getInstance().run(render_hq, [&]() {
+        TRACE_SCOPE("render HQ");
+        renderStimulus(data_hq, uiFactorHQ, gain_hq, meter_hq);
+        loudness_hq = meter_hq.getIntegrated();
+      });
+    }
+
+    {
+      TRACE_SCOPE("render LQ");
+      renderStimulus(data_lq, uiFactorLQ, gain_lq, meter_lq);
+      loudness_lq = meter_lq.getIntegrated();
+      truepeak_lq = meter_lq.getTruePeak();
+    }
+
+    ThreadPool::getInstance().wait(render_hq);
+    truepeak_hq = meter_hq.getTruePeak();
+
+    // Requantization noise shifts the level slightly, correct with the measured error
+    for (int retry = 0; retry < 3; retry++) {
+      double error = loudness_hq - loudness_lq;
+
+      if (fabs(error) <= LOUDNESS_MATCH_TOLERANCE || loudness_hq <= LOUDNESS_SILENCE || loudness_lq <= LOUDNESS_SILENCE) {
+        break;
       }
 
-      convertBitdepth(data_original, data_lq, bitdepth, uiFactorLQ);
+      if (gain_lq + error <= 0.0) {
+        gain_lq += error;
+        renderStimulus(data_lq, uiFactorLQ, gain_lq, meter_lq);
+        loudness_lq = meter_lq.getIntegrated();
+        truepeak_lq = meter_lq.getTruePeak();
+      }
+      else {
+        gain_hq -= error;
+        renderStimulus(data_hq, uiFactorHQ, gain_hq, meter_hq);
+        loudness_hq = meter_hq.getIntegrated();
+        truepeak_hq = meter_hq.getTruePeak();
+      }
     }
 
-    data_original.clear();
+    data_original.reset();
 
     result = true;
   }
 
-READ_SOUND_CLEANUP:
-  avformat_close_input(&avf_context);   // avformat_open_input
-  avformat_free_context(avf_context);   // avformat_alloc_context
-
   return result;
 }
 
@@ -335,150 +1008,748 @@ uint32_t SongSession::getSamplingrate() {
 }
 
 uint8_t SongSession::getBitdepth() {
-  return 24;
+  return (uint8_t)bitdepth;
 }
 
-bool SongSession::startPlaying(bool bFirst) {
-  bool result;
+bool SongSession::openStream() {
+  TRACE_SCOPE("openStream");
+  uint32_t preferred = bTestingSamplerate ? uiFactorHQ : samplingrate;
 
-  if (isInited())
+  if (!pSystem->negotiateFormat(output_device, channel_count, preferred, device)) {
     return false;
-  
+  }
+
   // fill default specs
   memset(&spec, 0, sizeof(PaStreamParameters));
-  spec.device = Pa_GetDefaultOutputDevice();
-  spec.channelCount = channel_count;
-  spec.suggestedLatency = Pa_GetDeviceInfo(spec.device)->defaultLowOutputLatency;
+  spec.device = device.device;
+  spec.channelCount = device.channel_count;
+  spec.sampleFormat = device.sample_format;
+  spec.suggestedLatency = device.latency;
+  current_freq = device.samplingrate;
+
+  playback = createPlayback();
+  setSource(playback, STIMULUS_HQ, stimulus->hq);
+  setSource(playback, STIMULUS_LQ, stimulus->lq);
+
+  // The tap sees the float mix, independent of the device format
+  pTap->setFormat(current_freq, spec.channelCount, sizeof(float));
 
-  if (bFirstSoundIsBetter ^ bFirst) { // play low quality
-    current_data = &data_lq;
-    byte_per_sample = bTestingSamplerate ? 3 : (uiFactorLQ >> 3);
-    current_freq = bTestingSamplerate ? uiFactorLQ : samplingrate;
-    spec.sampleFormat = byte_per_sample == 3 ? paInt24 : (byte_per_sample == 2 ? paInt16 : paUInt8);
+  current_stream = pSystem->getBackend()->openStream(spec, current_freq, current_freq * PLAYBACK_BUFFER_MS / 1000, fill_audio, playback);
+
+  if (current_stream == NULL) {
+    delete playback;
+    playback = NULL;
+    current_freq = 0;
+
+    return false;
   }
-  else {
-    current_data = &data_hq;
-    byte_per_sample = bTestingSamplerate ? 3 : (uiFactorHQ >> 3);
-    current_freq = bTestingSamplerate ? uiFactorHQ : samplingrate;
-    spec.sampleFormat = byte_per_sample == 3 ? paInt24 : (byte_per_sample == 2 ? paInt16 : paUInt8);
+
+  // Fallback for host APIs which don't report outputBufferDacTime
+  playback->output_latency = current_stream->getOutputLatency();
+
+  checkStream();
+
+  // Runs silent until a stimulus is requested
+  return current_stream->start();
+}
+
+bool SongSession::startPlaying(bool bFirst) {
+  TRACE_SCOPE("startPlaying");
+
+  if (isInited())
+    return false;
+
+  if (current_stream == NULL && !openStream()) {
+    return false;
+  }
+
+  if (bRealtime && !playback->bRealtime) {
+    prepareRealtime(playback);
   }
 
-  // Buffer as 0.1sec
-  uint32_t buffersize = current_freq * spec.channelCount / 10;
+  current_source = (bFirstSoundIsBetter ^ bFirst) ? STIMULUS_LQ : STIMULUS_HQ;
 
-  // Open audio
-  audio_index = 0;
-  result = Pa_OpenStream(&current_stream, NULL, &spec, current_freq, buffersize, paClipOff, fill_audio, this) == paNoError;
+  // Seek is published before the switch, so the callback sees both together
+  playback->bPaused = true;
+  playback->bFinished = false;
+  playback->seek_target.store(0, std::memory_order_relaxed);
+  playback->requested.store(current_source, std::memory_order_release);
 
-  return result;
+  return true;
 }
 
 bool SongSession::isInited() {
-  return current_freq != 0;
+  return current_source != STIMULUS_NONE;
 }
 
 bool SongSession::isPlaying() {
-  if (current_stream) {
-    return Pa_IsStreamStopped(current_stream) == 0;
+  if (playback && isInited()) {
+    return !playback->bPaused && !playback->bFinished;
   }
 
   return false;
 }
 
 void SongSession::togglePlaying() {
-  if (isPlaying()) {
-    Pa_StopStream(current_stream);
-  }
-  else {
-    Pa_StartStream(current_stream);
+  if (playback && isInited()) {
+    playback->bPaused = !playback->bPaused;
   }
 }
 
 void SongSession::stopPlaying() {
-  Pa_StopStream(current_stream);
-  Pa_CloseStream(current_stream);
-  current_stream = NULL;
-  current_freq = 0;
+  TRACE_SCOPE("stopPlaying");
+
+  if (playback && bRealtime) {
+    checkRealtime(playback);
+  }
+  if (playback) {
+    checkMisses(playback);
+  }
+
+  checkStream();
+
+  // The stream keeps running silent, it is only closed with the session
+  if (playback) {
+    playback->requested = STIMULUS_NONE;
+    playback->bPaused = true;
+  }
+
+  current_source = STIMULUS_NONE;
 }
 
 void SongSession::getTimeInfo(uint32_t &current, uint32_t &max) {
   if (isPlaying()) {
-    current = sampleToMs(audio_index / byte_per_sample);
-    max = sampleToMs(current_data->size() / byte_per_sample);
+    uint64_t seek = playback->seek_target;
+    uint64_t frame;
+    uint32_t length;
+    double dac;
+
+    if (seek != SEEK_NONE) {
+      // Report a pending seek so the slider doesn't jump back
+      current = frameToMs(seek);
+    }
+    else if (readPlayhead(frame, length, dac)) {
+      // What the listener hears now, never past the end of the last buffer
+      double elapsed = (current_stream->getTime() - dac) * current_freq;
+      double audible = frame + FFMIN(elapsed, (double)length);
+
+      current = frameToMs((uint64_t)FFMAX(audible, 0.0));
+    }
+    else {
+      current = 0;
+    }
+
+    max = frameToMs(playback->source[current_source].length);
   }
 }
 
+bool SongSession::readPlayhead(uint64_t &frame, uint32_t &length, double &dac) {
+  for (int retry = 0; retry < PLAYHEAD_RETRY; retry++) {
+    uint32_t before = playback->clock_sequence.load(std::memory_order_acquire);
+
+    if (before == 0) {
+      return false;   // nothing published yet
+    }
+
+    frame = playback->clock_frame.load(std::memory_order_relaxed);
+    length = playback->clock_length.load(std::memory_order_relaxed);
+    dac = playback->clock_dac.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (!(before & 1) && playback->clock_sequence.load(std::memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 void SongSession::setTime(uint32_t current) {
-  audio_index = msToSample(current) * byte_per_sample;
+  if (playback && isInited()) {
+    uint64_t target = msToFrame(current);
+
+    // Both stimuli, a switch right after the seek shouldn't wait either
+    for (auto &item : playback->source) {
+      if (item.ring) {
+        item.ring->pin(RING_PIN_SEEK, item.resampler.getSourceFrame(target));
+      }
+    }
+
+    Feeder::getInstance().wake();
+    playback->seek_target = target;
+  }
 }
 
-uint32_t SongSession::msToSample(uint32_t ms) {
-  float samples_per_second = current_freq * spec.channelCount;
-  return (uint32_t)(samples_per_second / 1000.f * ms + 0.5f);
+uint64_t SongSession::msToFrame(uint32_t ms) {
+  return (uint64_t)current_freq * ms / 1000;
 }
 
-uint32_t SongSession::sampleToMs(uint32_t sample) {
-  float samples_per_second = current_freq * spec.channelCount;
-  return (uint32_t)(sample / samples_per_second * 1000.f + 0.5f);
+uint32_t SongSession::frameToMs(uint64_t frame) {
+  return (uint32_t)((frame * 1000.0) / current_freq + 0.5);
 }
 
 void SongSession::getTestResult(bool &answer) {
   answer = bFirstSoundIsBetter;
 }
 
+void SongSession::getLoudnessInfo(double &lufsHQ, double &lufsLQ, double &peakHQ, double &peakLQ) {
+  lufsHQ = loudness_hq;
+  lufsLQ = loudness_lq;
+  peakHQ = truepeak_hq;
+  peakLQ = truepeak_lq;
+}
+
+void SongSession::getExcerpt(uint32_t &start, uint32_t &end) {
+  start = excerpt_start;
+  end = excerpt_end;
+}
+
+void SongSession::getIntegrityInfo(PlaybackIntegrity &info) {
+  info.misses = 0;
+
+  for (int i = 0; playback && i < STIMULUS_COUNT; i++) {
+    info.misses += playback->source[i].ring ? playback->source[i].ring->getMisses() : 0;
+  }
+
+  info.delivered = playback ? playback->delivered_hash.load() : 0;
+  info.played_hq = playback ? playback->played[STIMULUS_HQ].load() : 0;
+  info.played_lq = playback ? playback->played[STIMULUS_LQ].load() : 0;
+  info.skipped = playback ? playback->skipped.load() : 0;
+  info.silent = playback ? playback->silent.load() : 0;
+  info.delivered_hq = playback ? playback->source_digest[STIMULUS_HQ].load() : 0;
+  info.delivered_lq = playback ? playback->source_digest[STIMULUS_LQ].load() : 0;
+  info.hash_hq = hash_hq;
+  info.hash_lq = hash_lq;
+}
+
+PlaybackState *SongSession::createPlayback() {
+  PlaybackState *state = new PlaybackState;
+
+  // Misses are counted per ring, new rings start over
+  reported_misses = 0;
+
+  state->byte_per_sample = device.byte_per_sample;
+  state->channel_count = spec.channelCount;
+  state->output = Convert::getOutput(device.byte_per_sample, device.sample_format == paFloat32);
+  state->pTap = pTap;
+  state->mix.resize(current_freq * PLAYBACK_BUFFER_MS / 1000 * state->channel_count);
+  state->requested = STIMULUS_NONE;
+  state->bPaused = true;
+  state->bFinished = false;
+  state->playing = STIMULUS_NONE;
+  state->position = 0;
+  state->seek_target = SEEK_NONE;
+  state->clock_sequence = 0;
+  state->clock_frame = 0;
+  state->clock_length = 0;
+  state->clock_dac = 0.0;
+  state->output_latency = 0.0;
+  state->fade_source = STIMULUS_NONE;
+  state->fade_from = 0;
+
+  // Equal-power curve, fade out gain is the curve read backwards
+  uint32_t fade_frames = FFMAX(current_freq * SEEK_CROSSFADE_MS / 1000, 1u);
+
+  state->fade_pos = fade_frames;
+  state->fade_curve.resize(fade_frames);
+  state->fade_mix.resize(fade_frames * state->channel_count);
+
+  for (uint32_t i = 0; i < fade_frames; i++) {
+    state->fade_curve[i] = (float)sin(M_PI / 2 * (i + 0.5) / fade_frames);
+  }
+
+  for (int i = 0; i < STIMULUS_COUNT; i++) {
+    state->source[i].ring = NULL;
+    state->source[i].length = 0;
+    state->source[i].bLocked = false;
+    state->played[i] = 0;
+    state->source_hash[i].reset();
+    state->source_digest[i] = state->source_hash[i].digest();
+    state->hash_next[i] = 0;
+    state->hash_position[i] = 0;
+  }
+
+  state->delivered.reset();
+  state->delivered_hash = state->delivered.digest();
+  state->skipped = 0;
+  state->silent = 0;
+
+  state->bRealtime = false;
+  state->promote_result = PROMOTE_PENDING;
+
+  return state;
+}
+
+void SongSession::setSource(PlaybackState *state, int index, const CompressedPCM &data) {
+  StimulusSource &source = state->source[index];
+
+  source.ring = new PCMRing(data);
+  source.resampler.setRatio(data.getFormat().samplingrate, current_freq);
+  source.length = source.resampler.getOutputLength(data.getFrameCount());
+
+  // Only the first slot is decoded here, the most urgent one with the pin at
+  // the start. The feeder decodes the rest ahead of the playhead.
+  source.ring->pin(RING_PIN_PLAY, 0);
+  source.ring->feed();
+
+  Feeder::getInstance().add(source.ring);
+}
+
+PlaybackState::~PlaybackState() {
+  for (auto &item : source) {
+    if (item.ring) {
+      size_t size;
+      const char *storage = item.ring->getStorage(size);
+
+      Feeder::getInstance().remove(item.ring);
+
+      if (item.bLocked) {
+        RealTime::unlockMemory(storage, size);
+      }
+
+      delete item.ring;
+    }
+  }
+}
+
+void SongSession::prepareRealtime(PlaybackState *state) {
+  std::string error;
+
+  // Fault every page of the rings in now, then pin them so the callback never
+  // faults. The compressed data is only read by the feeder.
+  for (auto &item : state->source) {
+    if (item.ring) {
+      size_t size;
+      const char *storage = item.ring->getStorage(size);
+
+      RealTime::prefault(storage, size);
+      item.bLocked = RealTime::lockMemory(storage, size, error);
+
+      if (!item.bLocked) {
+        playback_report.append(error).append("\n");
+        break;
+      }
+    }
+  }
+
+  state->bRealtime = true;
+}
+
+void SongSession::checkRealtime(PlaybackState *state) {
+  // Report each problem once, the callback only promotes while pending
+  int promote = state->promote_result.exchange(PROMOTE_OK);
+
+  if (promote != PROMOTE_OK && promote != PROMOTE_PENDING) {
+    playback_report.append(RealTime::describePromoteError(promote)).append("\n");
+  }
+  if (promote == PROMOTE_PENDING) {
+    state->promote_result = PROMOTE_PENDING;
+  }
+}
+
+void SongSession::checkMisses(PlaybackState *state) {
+  uint64_t misses = 0;
+
+  // In every mode, silence from a feeder that fell behind is heard
+  for (auto &item : state->source) {
+    misses += item.ring ? item.ring->getMisses() : 0;
+  }
+
+  if (misses > reported_misses) {
+    playback_report.append(std::to_string(misses - reported_misses)).append(" reads weren't decoded in time and played as silence\n");
+  }
+
+  reported_misses = misses;
+}
+
+void SongSession::checkStream() {
+  std::string report;
+
+  // Headless streams tell their timing, or a file they couldn't write
+  if (current_stream && current_stream->getReport(report)) {
+    playback_report.append(report).append("\n");
+  }
+}
+
+void SongSession::setRealtimeMode(bool bEnable) {
+  bRealtime = bEnable;
+}
+
+void SongSession::setOutputDevice(PaDeviceIndex _output_device) {
+  // Negotiated when the stream opens, a running stream keeps its device
+  output_device = _output_device;
+}
+
+bool SongSession::getPlaybackReport(std::string &report) {
+  report = playback_report;
+  playback_report.clear();
+
+  return !report.empty();
+}
+
+bool SongSession::getDecodeReport(std::string &report) {
+  report = decode_report;
+  decode_report.clear();
+
+  return !report.empty();
+}
+
+void SongSession::predictLoudness(const float *samples, uint32_t frames, uint64_t first_frame, std::vector<float> &scratch) {
+  LoudnessMeter *meters[2] = { &meter_hq, &meter_lq };
+  uint32_t factors[2] = { uiFactorHQ, uiFactorLQ };
+
+  scratch.resize(frames * channel_count);
+
+  for (int m = 0; m < 2; m++) {
+    uint32_t count = 0;
+
+    if (bTestingSamplerate) {
+      // Same frames convertSamplingRate will keep
+      uint32_t step = samplingrate / factors[m];
+      uint32_t begin = (uint32_t)((step - first_frame % step) % step);
+
+      for (uint32_t i = begin; i < frames; i += step, count++) {
+        for (uint32_t c = 0; c < channel_count; c++) {
+          scratch[count * channel_count + c] = samples[i * channel_count + c];
+        }
+      }
+    }
+    else {
+      // Same truncation convertBitdepth will apply
+      Convert::quantize(samples, scratch.data(), frames * channel_count, 1.f, factors[m]);
+      count = frames;
+    }
+
+    meters[m]->process(scratch.data(), count);
+  }
+}
+
+void SongSession::renderStimulus(PCMBuffer &dst, uint32_t factor, double gain, LoudnessMeter &meter) {
+  double linear = pow(10.0, gain / 20.0);
+
+  if (bTestingSamplerate) {
+    meter.reset(factor, channel_count);
+    convertSamplingRate(data_original, dst, factor, linear, meter);
+  }
+  else {
+    meter.reset(samplingrate, channel_count);
+    convertBitdepth(data_original, dst, factor, linear, meter);
+  }
+}
+
+static inline void publishPlayhead(PlaybackState *pState, uint64_t frame, uint32_t length, double dac) {
+  uint32_t sequence = pState->clock_sequence.load(std::memory_order_relaxed);
+
+  pState->clock_sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  pState->clock_frame.store(frame, std::memory_order_relaxed);
+  pState->clock_length.store(length, std::memory_order_relaxed);
+  pState->clock_dac.store(dac, std::memory_order_relaxed);
+
+  pState->clock_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool SongSession::isReady(PlaybackState *pState, int index, uint64_t position) {
+  const StimulusSource &source = pState->source[index];
+
+  // Oldest and newest source frame of the first output frame, the rest of the
+  // buffer reads on into the guard
+  return source.ring->isReady(source.resampler.getFirstSourceFrame(position)) && source.ring->isReady(source.resampler.getSourceFrame(position));
+}
+
+uint32_t SongSession::renderSource(PlaybackState *pState, int index, uint64_t position, float *out, uint32_t frames) {
+  uint32_t channel = pState->channel_count;
+
+  if (index == STIMULUS_NONE) {
+    memset(out, 0, frames * channel * sizeof(float));
+
+    return 0;
+  }
+
+  const StimulusSource &source = pState->source[index];
+
+  return source.resampler.process(*source.ring, position, out, frames);
+}
+
+void SongSession::hashSource(PlaybackState *pState, int index) {
+  const StimulusSource &source = pState->source[index];
+  uint64_t frames = source.ring->getFrameCount();
+  uint32_t channel = source.ring->getFormat().channel_count;
+  uint64_t position = pState->position;
+  uint64_t &next = pState->hash_next[index];
+  uint64_t end;
+
+  // Up to the newest source frame the output has read, the rest of the
+  // source once the stimulus has played to its end
+  end = position >= source.length ? frames : FFMIN(source.resampler.getSourceFrame(position - 1) + 1, frames);
+
+  while (next < end) {
+    uint64_t available = 0;
+    const float *samples = source.ring->isReady(next) ? source.ring->getFrames(next, available) : NULL;
+
+    // Missed frames were silence, they aren't hashed and the digest differs
+    if (samples == NULL) {
+      next = end;
+      break;
+    }
+
+    available = FFMIN(available, end - next);
+    pState->source_hash[index].update(samples, (size_t)available * channel * sizeof(float));
+    next += available;
+  }
+
+  pState->hash_position[index] = position;
+}
+
 int SongSession::fill_audio(const void *inbuf, void *outbuf, unsigned long frames_per_buf, const PaStreamCallbackTimeInfo* time, PaStreamCallbackFlags flags, void *userdata) {
   Q_UNUSED(inbuf);
-  Q_UNUSED(time);
   Q_UNUSED(flags);
-  Q_UNUSED(userdata);
   
-  SongSession *pThis = (SongSession *)userdata;
-  int total_frame_count = pThis->current_data->size() / pThis->byte_per_sample / pThis->spec.channelCount;
-  int played_frame_count = pThis->audio_index / pThis->byte_per_sample / pThis->spec.channelCount;
+  PlaybackState *pState = (PlaybackState *)userdata;
+  bool bRealtime = pState->bRealtime;
+
+  if (bRealtime && pState->promote_result == PROMOTE_PENDING) {
+    pState->promote_result = RealTime::promoteThread();
+  }
 
-  int frame_left = total_frame_count - played_frame_count;
+  uint32_t channel = pState->channel_count;
+  int want = pState->requested.load(std::memory_order_acquire);
+  uint64_t seek = pState->seek_target.load();
+  bool bSeeked = false;
 
-  if (frame_left <= 0) {
-    return paComplete;
+  if (pState->bPaused) {
+    want = STIMULUS_NONE;
   }
 
-  int frame_to_copy = FFMIN((int)frames_per_buf, frame_left);
-  int byte_to_copy = frame_to_copy * pThis->byte_per_sample * pThis->spec.channelCount;
+  // Pinned here as well until applied, the UI's pin may have been released by
+  // the previous seek
+  for (int i = 0; seek != SEEK_NONE && i < STIMULUS_COUNT; i++) {
+    if (pState->source[i].ring) {
+      pState->source[i].ring->pin(RING_PIN_SEEK, pState->source[i].resampler.getSourceFrame(seek));
+    }
+  }
 
-  memcpy(outbuf, pThis->current_data->c_str() + pThis->audio_index, byte_to_copy);
-  pThis->audio_index += byte_to_copy;
+  // Switches, pauses and seeks all land at the start of a buffer, fading from
+  // where we were. They wait until the new position is decoded and the old
+  // one plays on meanwhile, a newer seek replaces one still waiting.
+  if (want != pState->playing || seek != SEEK_NONE) {
+    uint64_t target = seek != SEEK_NONE ? seek : pState->position;
+    bool bApply;
+
+    if (want != STIMULUS_NONE) {
+      target = FFMIN(target, pState->source[want].length);
+    }
+
+    bApply = want == STIMULUS_NONE || isReady(pState, want, target);
+    bApply = bApply && (seek == SEEK_NONE || pState->seek_target.compare_exchange_strong(seek, SEEK_NONE));
+    bSeeked = bApply && seek != SEEK_NONE;
+
+    if (bApply) {
+      if (target > pState->position) {
+        pState->skipped.store(pState->skipped.load(std::memory_order_relaxed) + target - pState->position, std::memory_order_relaxed);
+      }
+
+      if (want != pState->playing || target != pState->position) {
+        pState->fade_source = pState->playing;
+        pState->fade_from = pState->position;
+        pState->fade_pos = 0;
+      }
+
+      pState->playing = want;
+      pState->position = target;
+    }
+  }
+
+  // Tell the feeder where both stimuli are read before reading them, a switch
+  // continues at the same position. The old position stays pinned throughout.
+  for (int i = 0; i < STIMULUS_COUNT; i++) {
+    PCMRing *ring = pState->source[i].ring;
+    const Resampler &resampler = pState->source[i].resampler;
+
+    if (ring) {
+      ring->pin(RING_PIN_FADE, pState->fade_pos < pState->fade_curve.size() && pState->fade_source == i ? resampler.getSourceFrame(pState->fade_from) : RING_NONE);
+      ring->pin(RING_PIN_PLAY, resampler.getSourceFrame(pState->position));
+
+      if (bSeeked) {
+        ring->pin(RING_PIN_SEEK, RING_NONE);
+      }
+    }
+  }
+
+  uint64_t length = pState->playing != STIMULUS_NONE ? pState->source[pState->playing].length : 0;
+  uint32_t audible = pState->playing != STIMULUS_NONE ? (uint32_t)FFMIN((uint64_t)frames_per_buf, length - pState->position) : 0;
+
+  publishPlayhead(pState, pState->position, audible, time->outputBufferDacTime > 0 ? time->outputBufferDacTime : time->currentTime + pState->output_latency);
+
+  uint32_t fade_length = (uint32_t)pState->fade_curve.size();
+  uint32_t mix_frames = (uint32_t)pState->mix.size() / channel;
+  uint32_t done = 0;
+  uint32_t silent = 0;
+  bool bHashed = false;
+
+  // A stimulus hash goes on where the stimulus stopped, starts over when it
+  // starts over, and jumps with a seek
+  if (pState->playing != STIMULUS_NONE && pState->position != pState->hash_position[pState->playing]) {
+    int index = pState->playing;
+
+    if (pState->position == 0) {
+      pState->source_hash[index].reset();
+    }
+
+    pState->hash_next[index] = pState->source[index].resampler.getFirstSourceFrame(pState->position);
+  }
+
+  while (done < frames_per_buf) {
+    uint32_t frames = FFMIN((uint32_t)frames_per_buf - done, mix_frames);
+    float *mix = pState->mix.data();
+    char *out = (char *)outbuf + done * channel * pState->byte_per_sample;
+
+    // Silence while paused or past the end depends on timing, not on the stimulus
+    bool bAudible = (pState->playing != STIMULUS_NONE && pState->position < length) || pState->fade_pos < fade_length;
+
+    silent += renderSource(pState, pState->playing, pState->position, mix, frames);
+
+    if (pState->fade_pos < fade_length) {
+      const float *curve = pState->fade_curve.data();
+      float *old = pState->fade_mix.data();
+      uint32_t faded = FFMIN(frames, fade_length - pState->fade_pos);
+
+      silent += renderSource(pState, pState->fade_source, pState->fade_from, old, faded);
+
+      for (uint32_t f = 0; f < faded; f++) {
+        float gain_in = curve[pState->fade_pos + f];
+        float gain_out = curve[fade_length - 1 - pState->fade_pos - f];
+
+        for (uint32_t c = 0; c < channel; c++) {
+          mix[f * channel + c] = mix[f * channel + c] * gain_in + old[f * channel + c] * gain_out;
+        }
+      }
+
+      pState->fade_from += faded;
+      pState->fade_pos += faded;
+    }
+
+    // The only place float samples become device samples
+    pState->output(mix, out, frames * channel);
+    pState->pTap->push(mix, frames * channel * sizeof(float));
+
+    if (bAudible) {
+      pState->delivered.update(out, frames * channel * pState->byte_per_sample);
+      bHashed = true;
+    }
+
+    if (pState->playing != STIMULUS_NONE) {
+      std::atomic<uint64_t> &played = pState->played[pState->playing];
+
+      played.store(played.load(std::memory_order_relaxed) + FFMIN((uint64_t)frames, length - pState->position), std::memory_order_relaxed);
+      pState->position = FFMIN(pState->position + frames, length);
+    }
+
+    done += frames;
+  }
+
+  if (bHashed) {
+    pState->delivered_hash.store(pState->delivered.digest(), std::memory_order_relaxed);
+  }
+
+  if (pState->playing != STIMULUS_NONE && pState->position != pState->hash_position[pState->playing]) {
+    hashSource(pState, pState->playing);
+    pState->source_digest[pState->playing].store(pState->source_hash[pState->playing].digest(), std::memory_order_relaxed);
+  }
+
+  if (silent > 0) {
+    pState->silent.store(pState->silent.load(std::memory_order_relaxed) + silent, std::memory_order_relaxed);
+  }
+
+  pState->bFinished = pState->playing != STIMULUS_NONE && pState->position >= length;
 
   return paContinue;
 }
 
-void SongSession::convertSamplingRate(std::string &src, std::string &dst, uint32_t src_freq, uint32_t dst_freq, uint32_t channel) {
-  uint32_t step = src_freq / dst_freq;    // Always integer
-  uint32_t count = src.size();
-  uint32_t samplesize = 3 * channel;
+void SongSession::renderBlocks(uint64_t count, PCMWriter &out, std::function<void(float *, uint64_t, uint32_t)> kernel, LoudnessMeter &meter) {
+  ThreadPool &pool = ThreadPool::getInstance();
+  uint64_t blocks = (count + RENDER_BLOCK_FRAMES - 1) / RENDER_BLOCK_FRAMES;
+  std::vector<TaskGroup> groups((size_t)blocks);
 
-  dst.resize(count / step);
-  count = dst.size() / samplesize; // samples
+  // Blocks are independent and never span a segment of the output
+  for (uint64_t b = 0; b < blocks; b++) {
+    uint64_t first = b * RENDER_BLOCK_FRAMES;
+    uint32_t frames = (uint32_t)FFMIN(count - first, (uint64_t)RENDER_BLOCK_FRAMES);
 
-  for (uint32_t i = 0; i < count; i++) {
-    memcpy((char *)dst.c_str() + i * samplesize, src.c_str() + i * step * samplesize, samplesize);
+    pool.run(groups[(size_t)b], [=, &out]() {
+      TRACE_SCOPE("render block");
+      uint64_t available;
+
+      kernel(out.getFrames(first, available), first, frames);
+      out.commit(first, frames);
+    });
+  }
+
+  // The meter is stateful and has to see blocks in order, it follows the
+  // workers and helps them while the next block isn't ready
+  for (uint64_t b = 0; b < blocks; b++) {
+    uint64_t first = b * RENDER_BLOCK_FRAMES;
+    uint64_t available;
+
+    pool.wait(groups[(size_t)b]);
+    meter.process(out.getFrames(first, available), (uint32_t)FFMIN(count - first, (uint64_t)RENDER_BLOCK_FRAMES));
   }
+
+  out.setFrameCount(count);
 }
 
-void SongSession::convertBitdepth(std::string &src, std::string &dst, uint32_t src_bits, uint32_t dst_bits) {
-  uint32_t count = src.size();
-  uint32_t dst_samplesize = dst_bits >> 3;
-  uint32_t src_samplesize = src_bits >> 3;
+void SongSession::convertSamplingRate(const PCMBuffer &src, PCMBuffer &dst, uint32_t dst_freq, double gain, LoudnessMeter &meter) {
+  TRACE_SCOPE("convertSamplingRate");
+  uint32_t channel = src.getFormat().channel_count;
+  uint32_t bits = src.getFormat().bitdepth;
+  uint32_t step = src.getFormat().samplingrate / dst_freq;    // Always integer
+  uint64_t count = src.getFrameCount() / step;                // frames
+  PCMWriter result({ dst_freq, channel, bits }, count);
+  Convert::DecimateFunc decimate = Convert::getDecimate(channel);
+
+  renderBlocks(count, result, [=, &src](float *out, uint64_t first, uint32_t frames) {
+    uint32_t done = 0;
+
+    // Sub-blocks so quantize reads what was just copied while it is still in
+    // cache, also split where the source changes segment
+    while (done < frames) {
+      uint64_t available;
+      const float *in = src.getFrames((first + done) * step, available);
+      uint32_t length = (uint32_t)FFMIN(FFMIN((uint64_t)(frames - done), (uint64_t)METER_BLOCK_FRAMES), (available + step - 1) / step);
+      float *block = out + (size_t)done * channel;
+
+      decimate(in, block, length, step, channel);
+      Convert::quantize(block, block, length * channel, (float)gain, bits);
+
+      done += length;
+    }
+  }, meter);
 
-  dst.resize(src.size() * dst_samplesize / src_samplesize);
-  count = dst.size() / dst_samplesize; // samples
+  dst = result.finish();
+}
 
-  for (uint32_t i = 0; i < count; i++) {
-    memcpy((char *)dst.c_str() + i * dst_samplesize, src.c_str() + i * src_samplesize + (src_samplesize - dst_samplesize), dst_samplesize);
-  }
+void SongSession::convertBitdepth(const PCMBuffer &src, PCMBuffer &dst, uint32_t dst_bits, double gain, LoudnessMeter &meter) {
+  TRACE_SCOPE("convertBitdepth");
+  uint32_t channel = src.getFormat().channel_count;
+  uint64_t count = src.getFrameCount();   // frames
+  PCMWriter result({ src.getFormat().samplingrate, channel, dst_bits }, count);
+
+  renderBlocks(count, result, [=, &src](float *out, uint64_t first, uint32_t frames) {
+    uint32_t done = 0;
+
+    while (done < frames) {
+      uint64_t available;
+      const float *in = src.getFrames(first + done, available);
+      uint32_t length = (uint32_t)FFMIN((uint64_t)(frames - done), available);
 
-  if (dst_samplesize == 1) {
-    for (uint32_t i = 0; i < count; i++) {
-      dst.at(i) += 0x80;
+      // Truncate, keeping upper bits
+      Convert::quantize(in, out + (size_t)done * channel, length * channel, (float)gain, dst_bits);
+
+      done += length;
     }
-  }
+  }, meter);
+
+  dst = result.finish();
 }
@@ -8,17 +8,54 @@
 #include <functional>
 #include <exception>
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <tuple>
 #include <time.h>
 #include <portaudio.h>
 
 #include "Model.h"
+#include "Analyzer.h"
+#include "Loudness.h"
+#include "Buffer.h"
+#include "RealTime.h"
+#include "Convert.h"
+#include "Dispatch.h"
+#include "Resampler.h"
+#include "Backend.h"
+#include "ThreadPool.h"
+#include "Stimulus.h"
+#include "Feeder.h"
+#include "Hash.h"
+#include "Trace.h"
 
 extern "C" {
   #include <libavcodec/avcodec.h>
   #include <libavformat/avformat.h>
 }
 
-#define MAX_AUDIO_FRAME_SIZE    192000
+#define METER_BLOCK_FRAMES      4096
+#define RENDER_BLOCK_FRAMES     (METER_BLOCK_FRAMES * 16)   // unit of work on the pool, divides SEGMENT_ALIGN_FRAMES
+#define SEEK_CROSSFADE_MS       5
+#define SEEK_NONE               UINT64_MAX
+#define PLAYHEAD_RETRY          4
+#define PLAYBACK_BUFFER_MS      100
+#define DECODE_ENV              "LISTENING_TEST_DECODE"     // serial, or verify to check segments against it
+#define DECODE_PREROLL_MS       1000                        // decoded ahead of a seek and dropped
+#define DECODE_SEGMENT_SECONDS  20                          // unit of parallel decoding
+
+#define DECODE_PARALLEL         0
+#define DECODE_SERIAL           1
+#define DECODE_VERIFY           2
+
+#define STIMULUS_NONE           -1
+#define STIMULUS_HQ             0
+#define STIMULUS_LQ             1
+#define STIMULUS_COUNT          2
 
 #define STRING_COMBO_TESTTYPE   "<Test Type>"
 #define STRING_COMBO_HQ_AUDIO   "<HQ Audio Factor>"
@@ -31,49 +68,212 @@ extern "C" {
 #pragma comment(lib, "portaudio_x86.lib")
 #endif
 
+class SongSession;
+
+// Output format picked once per device configuration, every stimulus is
+// rendered to it
+struct DeviceFormat {
+  PaDeviceIndex device;
+  uint32_t samplingrate;
+  uint32_t channel_count;
+  PaSampleFormat sample_format;
+  uint32_t byte_per_sample;
+  double latency;                       // suggested, seconds
+};
+
+// One stimulus as the callback sees it, decompressed by the feeder around the
+// playhead and resampled to the device rate on the fly
+struct StimulusSource {
+  PCMRing *ring;
+  Resampler resampler;
+  uint64_t length;                      // frames at device rate
+  bool bLocked;
+};
+
+// State read by the stream callback. A session keeps one stream open and
+// switches stimuli by posting requests here, so the device never reopens.
+struct PlaybackState {
+  StimulusSource source[STIMULUS_COUNT];
+  uint32_t byte_per_sample;             // device side
+  uint32_t channel_count;
+  Convert::OutputFunc output;
+  AudioTap *pTap;
+  std::vector<float> mix;
+
+  // Requests from the UI
+  std::atomic<int> requested;           // STIMULUS_*
+  std::atomic<bool> bPaused;
+  std::atomic<bool> bFinished;
+
+  // Callback only
+  int playing;
+  uint64_t position;                    // in frames
+
+  // Seeks are posted here and applied by the callback with a crossfade, once
+  // the feeder has decoded the target
+  std::atomic<uint64_t> seek_target;    // in frames
+  int fade_source;
+  uint64_t fade_from;                   // old position, in frames
+  uint32_t fade_pos;
+  std::vector<float> fade_curve;
+  std::vector<float> fade_mix;
+
+  // Playhead published by the callback under a sequence lock: first frame of
+  // the last buffer, its length and the stream time it reaches the DAC
+  std::atomic<uint32_t> clock_sequence;
+  std::atomic<uint64_t> clock_frame;
+  std::atomic<uint32_t> clock_length;
+  std::atomic<double> clock_dac;
+  double output_latency;
+
+  std::atomic<bool> bRealtime;
+  std::atomic<int> promote_result;
+
+  // What the listener got: hash of every device buffer while a stimulus was
+  // audible, frames played of each stimulus and frames jumped over by seeks
+  XXHash64 delivered;                   // callback only
+  std::atomic<uint64_t> delivered_hash;
+  std::atomic<uint64_t> played[STIMULUS_COUNT];
+  std::atomic<uint64_t> skipped;
+  std::atomic<uint64_t> silent;         // frames a ring miss left silent
+
+  // Source frames of each stimulus hashed in the order they were delivered,
+  // the same bytes hashStimulus sees when nothing was seeked or missed
+  XXHash64 source_hash[STIMULUS_COUNT]; // callback only
+  uint64_t hash_next[STIMULUS_COUNT];   // callback only, next source frame
+  uint64_t hash_position[STIMULUS_COUNT]; // callback only, where it stopped
+  std::atomic<uint64_t> source_digest[STIMULUS_COUNT];
+
+  ~PlaybackState();
+};
+
 class AudioSystem {
+  private:
+    AudioBackend *backend;
+    StimulusStore store;
+
+    // Backend comes up on its own thread, host API enumeration can take
+    // seconds and the windows shouldn't wait for it
+    std::thread starter;
+    std::mutex ready_lock;
+    std::condition_variable ready_cond;
+    std::atomic<bool> bReady;
+    PaDeviceIndex default_device;
+    std::vector<OutputDevice> output_devices;
+
+    // Background thread for slow teardown (stream shutdown, freeing sessions)
+    std::thread reaper;
+    std::mutex reaper_lock;
+    std::condition_variable reaper_cond;
+    std::deque<std::function<void()>> reaper_jobs;
+    bool bReaperExit;
+
+    // Negotiated output formats keyed by device, channel count and preferred rate
+    std::mutex device_lock;
+    std::map<std::tuple<PaDeviceIndex, uint32_t, uint32_t>, DeviceFormat> device_formats;
+
+    void reaperMain();
+    void starterMain();
+    void waitReady();
+
   public:
     AudioSystem();
     ~AudioSystem();
 
-    bool getInfo(std::string &, uint32_t &, uint8_t &);
+    bool getInfo(std::string &, uint32_t &, uint8_t &, uint32_t &);
+    StimulusStore *getStore();
+    AudioBackend *getBackend();
+    bool isReady();
+    PaDeviceIndex getDefaultDevice();
+    void getOutputDevices(std::vector<OutputDevice> &);
+    bool negotiateFormat(PaDeviceIndex, uint32_t, uint32_t, DeviceFormat &);
+
+    void defer(std::function<void()>);
+    void releaseSession(SongSession *);
+    void closeStream(AudioStream *, PlaybackState *);
 };
 
 class SongSession {
   private:
     AudioSystem *pSystem;
+    AudioTap *pTap;
+    PaDeviceIndex output_device;
 
+    std::string path;
     AVFormatContext *avf_context;
     uint32_t stream_id;
     uint32_t samplingrate;
     uint32_t channel_count;
     uint32_t bitdepth;
 
-    uint32_t audio_index;
     PaStreamParameters spec;
-    PaStream *current_stream;
+    AudioStream *current_stream;
+    PlaybackState *playback;
+    DeviceFormat device;
     uint32_t current_freq;
-    uint32_t byte_per_sample;
-    std::string *current_data;
+    int current_source;
 
-    std::string data_original;
-    std::string data_hq;
-    std::string data_lq;
+    PCMBuffer data_original;
+    PCMBuffer data_hq;
+    PCMBuffer data_lq;
+    std::shared_ptr<const Stimulus> stimulus;
 
     bool bFirstSoundIsBetter;
     bool bTestingSamplerate;
     uint32_t uiFactorHQ;
     uint32_t uiFactorLQ;
+    uint32_t excerpt_start;               // ms
+    uint32_t excerpt_end;                 // ms, 0 plays to the end
+
+    bool bRealtime;
+    std::string playback_report;
+    uint64_t reported_misses;
+    std::string decode_report;            // outcome of DECODE_ENV=verify
+
+    LoudnessMeter meter_hq;
+    LoudnessMeter meter_lq;
+    double loudness_hq;
+    double loudness_lq;
+    double truepeak_hq;
+    double truepeak_lq;
+    uint64_t hash_hq;
+    uint64_t hash_lq;
 
     static int fill_audio(const void *, void *, unsigned long, const PaStreamCallbackTimeInfo *, PaStreamCallbackFlags, void *);
-    uint32_t msToSample(uint32_t);
-    uint32_t sampleToMs(uint32_t);
+    static bool isReady(PlaybackState *, int, uint64_t);
+    static uint32_t renderSource(PlaybackState *, int, uint64_t, float *, uint32_t);
+    static void hashSource(PlaybackState *, int);
+    uint64_t msToFrame(uint32_t);
+    uint32_t frameToMs(uint64_t);
+    bool readPlayhead(uint64_t &, uint32_t &, double &);
 
-    static void convertSamplingRate(std::string &, std::string &, uint32_t, uint32_t, uint32_t);
-    static void convertBitdepth(std::string &, std::string &, uint32_t, uint32_t);
+    void predictLoudness(const float *, uint32_t, uint64_t, std::vector<float> &);
+    void renderStimulus(PCMBuffer &, uint32_t, double, LoudnessMeter &);
+    PlaybackState *createPlayback();
+    void setSource(PlaybackState *, int, const CompressedPCM &);
+    bool prepareSound();
+    bool openStream();
+    void prepareRealtime(PlaybackState *);
+    void checkRealtime(PlaybackState *);
+    void checkMisses(PlaybackState *);
+    void checkStream();
+
+    // Decoded frames in order, at most a segment at once
+    typedef std::function<void(const float *, uint32_t)> DecodeSink;
+
+    static uint32_t getResolution(const AVCodecParameters *);
+    static Convert::InputFunc getInput(AVSampleFormat, uint32_t);
+    static bool isSegmentable(const AVCodecParameters *);
+    static bool decodeRange(AVFormatContext *, uint32_t, uint32_t, uint64_t, uint64_t, bool, const DecodeSink &);
+    static bool decodeSegments(AVFormatContext *, const std::string &, uint32_t, uint32_t, uint64_t, uint64_t, uint64_t, uint32_t, const DecodeSink &);
+    static uint64_t hashStimulus(const CompressedPCM &);
+    static std::string verifyDecode(const std::string &, uint32_t, uint64_t, uint64_t, uint32_t, const PCMBuffer &);
+    static void renderBlocks(uint64_t, PCMWriter &, std::function<void(float *, uint64_t, uint32_t)>, LoudnessMeter &);
+    static void convertSamplingRate(const PCMBuffer &, PCMBuffer &, uint32_t, double, LoudnessMeter &);
+    static void convertBitdepth(const PCMBuffer &, PCMBuffer &, uint32_t, double, LoudnessMeter &);
 
   public:
-    SongSession(AudioSystem *);
+    SongSession(AudioSystem *, AudioTap *, PaDeviceIndex);
     ~SongSession();
 
     void getTestTypes(std::vector<std::string> &);
@@ -87,6 +287,8 @@ class SongSession {
     void sineWaveTest(int);
 
     bool openSound(const char *);
+    void setExcerpt(uint32_t, uint32_t);
+    void getExcerpt(uint32_t &, uint32_t &);
     bool readSound();
 
     uint32_t getSamplingrate();
@@ -98,10 +300,17 @@ class SongSession {
     void togglePlaying();
     void stopPlaying();
 
+    void setRealtimeMode(bool);
+    void setOutputDevice(PaDeviceIndex);
+    bool getPlaybackReport(std::string &);
+    bool getDecodeReport(std::string &);
+
     void getTimeInfo(uint32_t &, uint32_t &);
     void setTime(uint32_t);
     
     void getTestResult(bool &);
+    void getLoudnessInfo(double &, double &, double &, double &);
+    void getIntegrityInfo(PlaybackIntegrity &);
 };
 
 #endif
@@ -0,0 +1,367 @@
+#include "Backend.h"
+#include "Trace.h"
+
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+
+AudioBackend *AudioBackend::create() {
+  const char *name = getenv(BACKEND_ENV);
+
+  if (name) {
+    if (strcmp(name, "null") == 0) {
+      return new ClockBackend("");
+    }
+    else if (strncmp(name, BACKEND_WAV_PREFIX, strlen(BACKEND_WAV_PREFIX)) == 0) {
+      return new ClockBackend(name + strlen(BACKEND_WAV_PREFIX));
+    }
+  }
+
+  return new PortAudioBackend();
+}
+
+uint32_t AudioBackend::getSampleSize(PaSampleFormat format) {
+  switch (format & ~paNonInterleaved) {
+    case paFloat32:
+    case paInt32:
+      return 4;
+    case paInt24:
+      return 3;
+    case paInt16:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+// PortAudio
+
+class PortAudioStream : public AudioStream {
+  private:
+    PaStream *stream;
+
+  public:
+    PortAudioStream(PaStream *_stream) : stream(_stream) {}
+
+    ~PortAudioStream() {
+      Pa_StopStream(stream);
+      Pa_CloseStream(stream);
+    }
+
+    bool start() {
+      return Pa_StartStream(stream) == paNoError;
+    }
+
+    void stop() {
+      Pa_StopStream(stream);
+    }
+
+    double getTime() {
+      return Pa_GetStreamTime(stream);
+    }
+
+    double getOutputLatency() {
+      return Pa_GetStreamInfo(stream)->outputLatency;
+    }
+};
+
+PortAudioBackend::PortAudioBackend() {
+  Pa_Initialize();
+}
+
+PortAudioBackend::~PortAudioBackend() {
+  Pa_Terminate();
+}
+
+const char *PortAudioBackend::getName() {
+  return "portaudio";
+}
+
+PaDeviceIndex PortAudioBackend::getDefaultDevice() {
+  return Pa_GetDefaultOutputDevice();
+}
+
+void PortAudioBackend::getOutputDevices(std::vector<OutputDevice> &devices) {
+  devices.clear();
+
+  for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); i++) {
+    const PaDeviceInfo *info = Pa_GetDeviceInfo(i);
+
+    if (info && info->maxOutputChannels > 0) {
+      const PaHostApiInfo *host = Pa_GetHostApiInfo(info->hostApi);
+
+      devices.push_back({ i, std::string(info->name) + (host ? std::string(" (") + host->name + ")" : "") });
+    }
+  }
+}
+
+double PortAudioBackend::getDefaultSampleRate(PaDeviceIndex device) {
+  return Pa_GetDeviceInfo(device)->defaultSampleRate;
+}
+
+double PortAudioBackend::getDefaultLatency(PaDeviceIndex device) {
+  return Pa_GetDeviceInfo(device)->defaultLowOutputLatency;
+}
+
+bool PortAudioBackend::isFormatSupported(const PaStreamParameters &param, double rate) {
+  return Pa_IsFormatSupported(NULL, &param, rate) == paFormatIsSupported;
+}
+
+AudioStream *PortAudioBackend::openStream(const PaStreamParameters &param, double rate, unsigned long frames, PaStreamCallback *callback, void *userdata) {
+  PaStream *stream;
+
+  if (Pa_OpenStream(&stream, NULL, &param, rate, frames, paClipOff, callback, userdata) != paNoError) {
+    return NULL;
+  }
+
+  return new PortAudioStream(stream);
+}
+
+// Clock driven stream
+
+ClockStream::ClockStream(const char *_name, const PaStreamParameters &_param, double rate, unsigned long frames, PaStreamCallback *_callback, void *_userdata) {
+  name = _name;
+  param = _param;
+  samplingrate = rate;
+  frames_per_buffer = frames;
+  callback = _callback;
+  userdata = _userdata;
+
+  bRunning = false;
+  epoch = std::chrono::steady_clock::now();
+  buffer.resize(frames * param.channelCount * AudioBackend::getSampleSize(param.sampleFormat));
+
+  callbacks = 0;
+  late = 0;
+  total_cost = 0.0;
+  max_cost = 0.0;
+  max_jitter = 0.0;
+}
+
+ClockStream::~ClockStream() {
+  stop();
+}
+
+bool ClockStream::start() {
+  if (bRunning) {
+    return false;
+  }
+
+  bRunning = true;
+  worker = std::thread(&ClockStream::run, this);
+
+  return true;
+}
+
+void ClockStream::stop() {
+  bRunning = false;
+
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
+
+double ClockStream::getTime() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+double ClockStream::getOutputLatency() {
+  // One buffer queued ahead, as a double buffered device would
+  return frames_per_buffer / samplingrate;
+}
+
+bool ClockStream::getReport(std::string &result) {
+  std::lock_guard<std::mutex> guard(stats_lock);
+  std::stringstream report;
+
+  if (!error.empty()) {
+    report << error << "\n";
+  }
+
+  // Nothing to tell before the first callback
+  if (callbacks == 0) {
+    result = report.str();
+
+    return !result.empty();
+  }
+
+  report << name << ": " << callbacks << " callbacks of " << frames_per_buffer << " frames at " << samplingrate << " Hz";
+
+  report << ", cost avg " << total_cost / callbacks * 1e6 << " us max " << max_cost * 1e6 << " us";
+  report << ", wakeup jitter max " << max_jitter * 1e3 << " ms";
+  report << ", " << late << " late";
+
+  result = report.str();
+
+  return true;
+}
+
+void ClockStream::deliver(const char *, size_t) {
+}
+
+void ClockStream::run() {
+  double period = frames_per_buffer / samplingrate;
+  double begin = getTime();
+  uint64_t count = 0;
+
+  Trace::setThreadName(name.c_str());
+
+  while (bRunning) {
+    // Deadlines from the start time, so rounding never accumulates as drift
+    double deadline = begin + count * period;
+    double now = getTime();
+
+    if (now < deadline) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(deadline - now));
+      now = getTime();
+    }
+
+    PaStreamCallbackTimeInfo info;
+
+    info.inputBufferAdcTime = 0.0;
+    info.currentTime = now;
+    info.outputBufferDacTime = deadline + getOutputLatency();
+
+    int result = callback(NULL, buffer.data(), frames_per_buffer, &info, 0, userdata);
+    double cost = getTime() - now;
+
+    deliver(buffer.data(), buffer.size());
+
+    // A buffer finished after it should have started playing is a glitch
+    std::lock_guard<std::mutex> guard(stats_lock);
+
+    callbacks++;
+    total_cost += cost;
+    max_cost = cost > max_cost ? cost : max_cost;
+    max_jitter = now - deadline > max_jitter ? now - deadline : max_jitter;
+
+    if (now + cost > info.outputBufferDacTime) {
+      late++;
+    }
+
+    count++;
+
+    if (result != paContinue) {
+      break;
+    }
+  }
+}
+
+// WAV sink
+
+static void writeLE(FILE *file, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    fputc((value >> (8 * i)) & 0xFF, file);
+  }
+}
+
+WavStream::WavStream(const std::string &path, const PaStreamParameters &param, double rate, unsigned long frames, PaStreamCallback *callback, void *userdata)
+  : ClockStream("wav", param, rate, frames, callback, userdata) {
+  data_size = 0;
+  file = fopen(path.c_str(), "wb");
+
+  if (file) {
+    writeHeader();
+  }
+  else {
+    error = "wav: cannot open " + path;
+  }
+}
+
+WavStream::~WavStream() {
+  // Worker has to be gone before the header is patched
+  stop();
+
+  if (file) {
+    fseek(file, 0, SEEK_SET);
+    writeHeader();
+    fclose(file);
+  }
+}
+
+void WavStream::writeHeader() {
+  uint32_t size = AudioBackend::getSampleSize(param.sampleFormat);
+  uint32_t data = data_size > UINT32_MAX - 36 ? UINT32_MAX - 36 : (uint32_t)data_size;
+
+  fwrite("RIFF", 1, 4, file);
+  writeLE(file, data + 36, 4);
+  fwrite("WAVEfmt ", 1, 8, file);
+  writeLE(file, 16, 4);
+  writeLE(file, param.sampleFormat == paFloat32 ? 3 : 1, 2);  // IEEE float or PCM
+  writeLE(file, param.channelCount, 2);
+  writeLE(file, (uint32_t)samplingrate, 4);
+  writeLE(file, (uint32_t)samplingrate * param.channelCount * size, 4);
+  writeLE(file, param.channelCount * size, 2);
+  writeLE(file, size * 8, 2);
+  fwrite("data", 1, 4, file);
+  writeLE(file, data, 4);
+}
+
+void WavStream::deliver(const char *data, size_t size) {
+  if (file) {
+    data_size += fwrite(data, 1, size, file);
+  }
+}
+
+// Headless backend
+
+ClockBackend::ClockBackend(const std::string &_path) {
+  path = _path;
+  stream_count = 0;
+}
+
+const char *ClockBackend::getName() {
+  return path.empty() ? "null" : "wav";
+}
+
+PaDeviceIndex ClockBackend::getDefaultDevice() {
+  return 0;
+}
+
+void ClockBackend::getOutputDevices(std::vector<OutputDevice> &devices) {
+  devices.clear();
+
+  for (PaDeviceIndex i = 0; i < CLOCK_DEVICE_COUNT; i++) {
+    devices.push_back({ i, std::string(getName()) + " " + std::to_string(i + 1) });
+  }
+}
+
+double ClockBackend::getDefaultSampleRate(PaDeviceIndex) {
+  return CLOCK_DEFAULT_RATE;
+}
+
+double ClockBackend::getDefaultLatency(PaDeviceIndex) {
+  return 0.0;
+}
+
+bool ClockBackend::isFormatSupported(const PaStreamParameters &param, double rate) {
+  // Anything the WAV header can describe
+  return param.channelCount > 0 && rate > 0.0 && (param.sampleFormat & paNonInterleaved) == 0 && param.sampleFormat != paInt8;
+}
+
+AudioStream *ClockBackend::openStream(const PaStreamParameters &param, double rate, unsigned long frames, PaStreamCallback *callback, void *userdata) {
+  if (frames == paFramesPerBufferUnspecified) {
+    frames = (unsigned long)(rate / 100);
+  }
+
+  if (path.empty()) {
+    return new ClockStream("null", param, rate, frames, callback, userdata);
+  }
+
+  // First stream gets the given path, later ones a numbered sibling
+  std::string target = path;
+
+  if (stream_count++) {
+    size_t dot = target.rfind('.');
+    std::string suffix = "-" + std::to_string(stream_count);
+
+    if (dot == std::string::npos || target.find_first_of("/\\", dot) != std::string::npos) {
+      target.append(suffix);
+    }
+    else {
+      target.insert(dot, suffix);
+    }
+  }
+
+  return new WavStream(target, param, rate, frames, callback, userdata);
+}
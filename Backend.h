@@ -0,0 +1,149 @@
+#pragma once
+
+#ifndef _BACKEND_H_
+#define _BACKEND_H_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include <portaudio.h>
+
+#define BACKEND_ENV           "LISTENING_TEST_BACKEND"  // portaudio (default), null or wav:<path>
+#define BACKEND_WAV_PREFIX    "wav:"
+#define CLOCK_DEFAULT_RATE    48000.0
+#define CLOCK_DEVICE_COUNT    4         // virtual outputs, one per headless station
+
+struct OutputDevice {
+  PaDeviceIndex index;
+  std::string name;
+};
+
+// An opened output stream. Deleting it stops and closes it.
+class AudioStream {
+  public:
+    virtual ~AudioStream() {}
+
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+    virtual double getTime() = 0;
+    virtual double getOutputLatency() = 0;
+
+    // Statistics or errors worth showing, false if there are none
+    virtual bool getReport(std::string &) { return false; }
+};
+
+// Output side of the program. PortAudio types are kept as the common
+// vocabulary so the callback is the same for every backend.
+class AudioBackend {
+  public:
+    virtual ~AudioBackend() {}
+
+    virtual const char *getName() = 0;
+    virtual PaDeviceIndex getDefaultDevice() = 0;
+    virtual void getOutputDevices(std::vector<OutputDevice> &) = 0;
+    virtual double getDefaultSampleRate(PaDeviceIndex) = 0;
+    virtual double getDefaultLatency(PaDeviceIndex) = 0;
+    virtual bool isFormatSupported(const PaStreamParameters &, double) = 0;
+    virtual AudioStream *openStream(const PaStreamParameters &, double, unsigned long, PaStreamCallback *, void *) = 0;
+
+    static AudioBackend *create();
+    static uint32_t getSampleSize(PaSampleFormat);
+};
+
+class PortAudioBackend : public AudioBackend {
+  public:
+    PortAudioBackend();
+    ~PortAudioBackend();
+
+    const char *getName();
+    PaDeviceIndex getDefaultDevice();
+    void getOutputDevices(std::vector<OutputDevice> &);
+    double getDefaultSampleRate(PaDeviceIndex);
+    double getDefaultLatency(PaDeviceIndex);
+    bool isFormatSupported(const PaStreamParameters &, double);
+    AudioStream *openStream(const PaStreamParameters &, double, unsigned long, PaStreamCallback *, void *);
+};
+
+// Drives the callback from a steady clock at the stream rate, as a sound
+// card would, and keeps timing statistics of every callback.
+class ClockStream : public AudioStream {
+  private:
+    std::thread worker;
+    std::atomic<bool> bRunning;
+    std::chrono::steady_clock::time_point epoch;
+
+    PaStreamCallback *callback;
+    void *userdata;
+
+    // Statistics, read by getReport while the stream runs
+    std::mutex stats_lock;
+    uint64_t callbacks;
+    uint64_t late;
+    double total_cost;
+    double max_cost;
+    double max_jitter;
+
+    void run();
+
+  protected:
+    std::string name;
+    PaStreamParameters param;
+    double samplingrate;
+    unsigned long frames_per_buffer;
+    std::vector<char> buffer;
+    std::string error;
+
+    virtual void deliver(const char *, size_t);
+
+  public:
+    ClockStream(const char *, const PaStreamParameters &, double, unsigned long, PaStreamCallback *, void *);
+    ~ClockStream();
+
+    bool start();
+    void stop();
+    double getTime();
+    double getOutputLatency();
+    bool getReport(std::string &);
+};
+
+// ClockStream which also writes every delivered buffer to a WAV file
+class WavStream : public ClockStream {
+  private:
+    FILE *file;
+    uint64_t data_size;
+
+    void writeHeader();
+
+  protected:
+    void deliver(const char *, size_t);
+
+  public:
+    WavStream(const std::string &, const PaStreamParameters &, double, unsigned long, PaStreamCallback *, void *);
+    ~WavStream();
+};
+
+// Headless backend, one virtual device accepting any rate and format.
+// With a path every stream is also recorded to WAV.
+class ClockBackend : public AudioBackend {
+  private:
+    std::string path;
+    uint32_t stream_count;
+
+  public:
+    ClockBackend(const std::string &);
+
+    const char *getName();
+    PaDeviceIndex getDefaultDevice();
+    void getOutputDevices(std::vector<OutputDevice> &);
+    double getDefaultSampleRate(PaDeviceIndex);
+    double getDefaultLatency(PaDeviceIndex);
+    bool isFormatSupported(const PaStreamParameters &, double);
+    AudioStream *openStream(const PaStreamParameters &, double, unsigned long, PaStreamCallback *, void *);
+};
+
+#endif
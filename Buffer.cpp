@@ -0,0 +1,317 @@
+#include "Buffer.h"
+
+#include <algorithm>
+#include <string.h>
+
+static void releaseSegment(const std::string *data) {
+  PCMBufferPool::getInstance().release((std::string *)data);
+}
+
+PCMBuffer::PCMBuffer() {
+  segment_frames = 0;
+  frames = 0;
+  format = { 0, 0, 0 };
+}
+
+PCMBuffer::PCMBuffer(std::string &&data, PCMFormat _format) {
+  format = _format;
+  frames = getFrameSize() ? data.size() / getFrameSize() : 0;
+  segment_frames = frames;
+
+  // One segment holding everything, there is no next segment to guard
+  segments.push_back(std::make_shared<const std::string>(std::move(data)));
+}
+
+void PCMBuffer::reset() {
+  segments.clear();
+  segment_frames = 0;
+  frames = 0;
+}
+
+bool PCMBuffer::empty() const {
+  return frames == 0;
+}
+
+const float *PCMBuffer::getFrames(uint64_t first, uint64_t &available) const {
+  if (first >= frames) {
+    available = 0;
+
+    return NULL;
+  }
+
+  uint64_t index = first / segment_frames;
+  uint64_t local = first % segment_frames;
+  uint64_t end = std::min<uint64_t>((index + 1) * segment_frames + SEGMENT_GUARD_FRAMES, frames);
+
+  // The last segment has no guard
+  if (index + 1 == segments.size()) {
+    end = frames;
+  }
+
+  available = end - first;
+
+  return (const float *)segments[index]->data() + local * format.channel_count;
+}
+
+size_t PCMBuffer::getSegmentCount() const {
+  return segments.size();
+}
+
+const char *PCMBuffer::getSegment(size_t index, size_t &size) const {
+  // Pooled segments may be longer than what was asked for
+  size = std::min<size_t>(segments[index]->size(), (size_t)((segment_frames + SEGMENT_GUARD_FRAMES) * getFrameSize()));
+
+  return segments[index]->data();
+}
+
+const PCMFormat &PCMBuffer::getFormat() const {
+  return format;
+}
+
+uint32_t PCMBuffer::getFrameSize() const {
+  return format.channel_count * sizeof(float);
+}
+
+uint64_t PCMBuffer::getFrameCount() const {
+  return frames;
+}
+
+uint64_t PCMBuffer::getSampleCount() const {
+  return frames * format.channel_count;
+}
+
+PCMWriter::PCMWriter(PCMFormat _format, uint64_t expected) {
+  uint64_t frame_size = _format.channel_count * sizeof(float);
+
+  format = _format;
+  frames = 0;
+
+  // About one pool granule per segment, guard included, in whole aligned units
+  segment_frames = (POOL_GRANULARITY / frame_size - SEGMENT_GUARD_FRAMES) / SEGMENT_ALIGN_FRAMES * SEGMENT_ALIGN_FRAMES;
+  segment_frames = segment_frames > SEGMENT_ALIGN_FRAMES ? segment_frames : SEGMENT_ALIGN_FRAMES;
+
+  segments.reserve((size_t)(expected / segment_frames + 1));
+
+  while ((uint64_t)segments.size() * segment_frames < expected) {
+    addSegment();
+  }
+}
+
+PCMWriter::~PCMWriter() {
+  for (auto segment : segments) {
+    releaseSegment(segment);
+  }
+}
+
+void PCMWriter::addSegment() {
+  uint64_t size = (segment_frames + SEGMENT_GUARD_FRAMES) * format.channel_count * sizeof(float);
+
+  segments.push_back(PCMBufferPool::getInstance().acquire((size_t)size));
+}
+
+float *PCMWriter::getFrames(uint64_t first, uint64_t &available) {
+  uint64_t index = first / segment_frames;
+
+  if (index >= segments.size()) {
+    available = 0;
+
+    return NULL;
+  }
+
+  available = (index + 1) * segment_frames - first;
+
+  return (float *)segments[index]->c_str() + (first % segment_frames) * format.channel_count;
+}
+
+void PCMWriter::commit(uint64_t first, uint64_t count) {
+  uint64_t frame_size = format.channel_count * sizeof(float);
+
+  // Repeat the head of every segment touched into the tail of the one before
+  for (uint64_t index = first / segment_frames; index * segment_frames < first + count; index++) {
+    uint64_t begin = std::max<uint64_t>(first, index * segment_frames);
+    uint64_t end = std::min<uint64_t>(first + count, index * segment_frames + SEGMENT_GUARD_FRAMES);
+
+    if (index == 0 || begin >= end) {
+      continue;
+    }
+
+    uint64_t local = begin - index * segment_frames;
+    char *src = (char *)segments[index]->c_str() + local * frame_size;
+    char *dst = (char *)segments[index - 1]->c_str() + (segment_frames + local) * frame_size;
+
+    memcpy(dst, src, (size_t)((end - begin) * frame_size));
+  }
+}
+
+void PCMWriter::append(const float *src, uint64_t count) {
+  uint64_t frame_size = format.channel_count * sizeof(float);
+  uint64_t first = frames;
+
+  while (count > 0) {
+    if (frames / segment_frames >= segments.size()) {
+      addSegment();
+    }
+
+    uint64_t available;
+    float *dst = getFrames(frames, available);
+    uint64_t length = std::min<uint64_t>(available, count);
+
+    memcpy(dst, src, (size_t)(length * frame_size));
+
+    src += length * format.channel_count;
+    frames += length;
+    count -= length;
+  }
+
+  commit(first, frames - first);
+}
+
+void PCMWriter::setFrameCount(uint64_t count) {
+  frames = count;
+}
+
+uint64_t PCMWriter::getFrameCount() const {
+  return frames;
+}
+
+PCMBuffer PCMWriter::finish() {
+  PCMBuffer result;
+  size_t used = (size_t)((frames + segment_frames - 1) / segment_frames);
+
+  result.format = format;
+  result.frames = frames;
+  result.segment_frames = segment_frames;
+
+  // Segments go back to the pool when the last buffer using them is dropped
+  for (size_t i = 0; i < segments.size(); i++) {
+    if (i < used) {
+      result.segments.push_back(std::shared_ptr<const std::string>(segments[i], releaseSegment));
+    }
+    else {
+      releaseSegment(segments[i]);
+    }
+  }
+
+  segments.clear();
+  frames = 0;
+
+  return result;
+}
+
+PCMBufferPool::PCMBufferPool() {
+  pooled_bytes = 0;
+  limit = POOL_DEFAULT_LIMIT;
+}
+
+PCMBufferPool::~PCMBufferPool() {
+  for (auto buffer : vFree) {
+    delete buffer;
+  }
+}
+
+PCMBufferPool &PCMBufferPool::getInstance() {
+  static PCMBufferPool pool;
+
+  return pool;
+}
+
+std::string *PCMBufferPool::acquire(size_t size) {
+  std::string *result = NULL;
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t best = vFree.size();
+
+    // Smallest free buffer which is large enough
+    for (size_t i = 0; i < vFree.size(); i++) {
+      if (vFree[i]->capacity() >= size && (best == vFree.size() || vFree[i]->capacity() < vFree[best]->capacity())) {
+        best = i;
+      }
+    }
+
+    if (best < vFree.size()) {
+      result = vFree[best];
+      pooled_bytes -= result->capacity();
+      vFree.erase(vFree.begin() + best);
+    }
+  }
+
+  if (result == NULL) {
+    size_t capacity = (size + POOL_GRANULARITY - 1) / POOL_GRANULARITY * POOL_GRANULARITY;
+
+    // Touch every page now rather than on first use
+    result = new std::string();
+    result->resize(capacity);
+  }
+
+  // Recycled buffers keep their length and old contents, the writer
+  // overwrites them anyway
+  if (result->size() < size) {
+    result->resize(size);
+  }
+
+  return result;
+}
+
+void PCMBufferPool::release(std::string *buffer) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (buffer->capacity() > 0 && pooled_bytes + buffer->capacity() <= limit) {
+      pooled_bytes += buffer->capacity();
+      vFree.push_back(buffer);
+
+      return;
+    }
+  }
+
+  delete buffer;
+}
+
+void PCMBufferPool::setLimit(size_t _limit) {
+  std::vector<std::string *> vDrop;
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    limit = _limit;
+
+    while (pooled_bytes > limit && !vFree.empty()) {
+      pooled_bytes -= vFree.back()->capacity();
+      vDrop.push_back(vFree.back());
+      vFree.pop_back();
+    }
+  }
+
+  for (auto buffer : vDrop) {
+    delete buffer;
+  }
+}
+
+size_t PCMBufferPool::getPooledBytes() {
+  std::lock_guard<std::mutex> guard(lock);
+
+  return pooled_bytes;
+}
+
+size_t PCMBufferPool::trim(size_t bytes) {
+  std::vector<std::string *> vDrop;
+  size_t freed = 0;
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    while (freed < bytes && !vFree.empty()) {
+      freed += vFree.back()->capacity();
+      pooled_bytes -= vFree.back()->capacity();
+      vDrop.push_back(vFree.back());
+      vFree.pop_back();
+    }
+  }
+
+  for (auto buffer : vDrop) {
+    delete buffer;
+  }
+
+  return freed;
+}
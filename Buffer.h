@@ -0,0 +1,122 @@
+#pragma once
+
+#ifndef _BUFFER_H_
+#define _BUFFER_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define POOL_GRANULARITY        (16 << 20)    // 16MB
+#define POOL_DEFAULT_LIMIT      (2048ull << 20)
+#define SEGMENT_GUARD_FRAMES    4096          // longest window guaranteed contiguous
+#define SEGMENT_ALIGN_FRAMES    65536
+
+// Samples are always interleaved float32, bitdepth is the resolution they
+// were quantized to and decides the device format at playback.
+struct PCMFormat {
+  uint32_t samplingrate;
+  uint32_t channel_count;
+  uint32_t bitdepth;
+};
+
+// Anything playback reads frames from. getFrames returns NULL where no
+// frames are available, available is then 0.
+class PCMSource {
+  public:
+    virtual ~PCMSource() {}
+
+    virtual const float *getFrames(uint64_t, uint64_t &) const = 0;
+    virtual const PCMFormat &getFormat() const = 0;
+    virtual uint64_t getFrameCount() const = 0;
+};
+
+// Immutable, reference counted PCM data, stored as fixed size segments so it
+// never has to be moved to grow. Copying a PCMBuffer only copies the segment
+// table, the samples themselves are shared. Each segment ends with a copy of
+// the first SEGMENT_GUARD_FRAMES of the next, so a window up to that long is
+// always contiguous in memory.
+class PCMBuffer : public PCMSource {
+  friend class PCMWriter;
+
+  private:
+    std::vector<std::shared_ptr<const std::string>> segments;
+    uint64_t segment_frames;
+    uint64_t frames;
+    PCMFormat format;
+
+  public:
+    PCMBuffer();
+    PCMBuffer(std::string &&, PCMFormat);
+
+    void reset();
+    bool empty() const;
+
+    // Frames from first on, with the number of frames contiguous there
+    const float *getFrames(uint64_t, uint64_t &) const override;
+    size_t getSegmentCount() const;
+    const char *getSegment(size_t, size_t &) const;
+
+    const PCMFormat &getFormat() const override;
+    uint32_t getFrameSize() const;
+    uint64_t getFrameCount() const override;
+    uint64_t getSampleCount() const;
+};
+
+// Fills a PCMBuffer. Segments for the expected length are taken from the
+// pool up front and more are added past it, nothing written is ever copied.
+// Disjoint ranges can be written from several threads through getFrames and
+// commit, append is for a single producer.
+class PCMWriter {
+  private:
+    std::vector<std::string *> segments;
+    uint64_t segment_frames;
+    uint64_t frames;
+    PCMFormat format;
+
+    void addSegment();
+
+  public:
+    PCMWriter(PCMFormat, uint64_t);
+    ~PCMWriter();
+
+    float *getFrames(uint64_t, uint64_t &);
+    void commit(uint64_t, uint64_t);
+    void append(const float *, uint64_t);
+    void setFrameCount(uint64_t);
+    uint64_t getFrameCount() const;
+
+    PCMBuffer finish();
+};
+
+// Process-wide cache of large, already faulted-in sample buffers. Buffers
+// acquired here and wrapped in a PCMBuffer come back automatically when the
+// last view is dropped, so switching songs reuses memory instead of returning
+// it to the OS and faulting it in again.
+class PCMBufferPool {
+  private:
+    std::mutex lock;
+    std::vector<std::string *> vFree;
+    size_t pooled_bytes;
+    size_t limit;
+
+    PCMBufferPool();
+    ~PCMBufferPool();
+
+  public:
+    static PCMBufferPool &getInstance();
+
+    // At least the given bytes, a recycled buffer is not cleared
+    std::string *acquire(size_t);
+    void release(std::string *);
+
+    void setLimit(size_t);
+    size_t getPooledBytes();
+
+    // Frees pooled buffers until about the given bytes are given back, returns how many were
+    size_t trim(size_t);
+};
+
+#endif
@@ -0,0 +1,389 @@
+#include "Codec.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define BLOCK_RICE    0
+#define BLOCK_FLOAT   1
+
+static inline uint32_t countLeadingZeros(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+
+  _BitScanReverse64(&index, value);
+
+  return 63 - index;
+#else
+  return __builtin_clzll(value);
+#endif
+}
+
+static inline uint32_t zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// MSB first, straight into the output string
+class BitWriter {
+  private:
+    std::string &out;
+    uint64_t cache;
+    uint32_t count;
+
+  public:
+    BitWriter(std::string &_out) : out(_out), cache(0), count(0) {}
+
+    inline void write(uint32_t value, uint32_t bits) {
+      cache = (cache << bits) | value;
+      count += bits;
+
+      while (count >= 8) {
+        count -= 8;
+        out.push_back((char)(cache >> count));
+      }
+    }
+
+    inline void flush() {
+      if (count) {
+        write(0, 8 - count);
+      }
+    }
+};
+
+// Reads up to 8 bytes past the last bit, the stream is padded for it
+class BitReader {
+  private:
+    const uint8_t *data;
+    uint64_t cache;
+    uint32_t count;
+
+    inline void refill() {
+      while (count <= 56) {
+        cache |= (uint64_t)*data++ << (56 - count);
+        count += 8;
+      }
+    }
+
+  public:
+    BitReader(const uint8_t *_data) : data(_data), cache(0), count(0) {}
+
+    inline uint32_t read(uint32_t bits) {
+      if (bits == 0) {
+        return 0;
+      }
+
+      refill();
+
+      uint32_t value = (uint32_t)(cache >> (64 - bits));
+
+      cache <<= bits;
+      count -= bits;
+
+      return value;
+    }
+
+    // Zeros up to the next one, which is consumed. An escape is at most
+    // CODEC_RICE_ESCAPE zeros, so a refilled cache always holds the one.
+    inline uint32_t readUnary() {
+      refill();
+
+      uint32_t zeros = countLeadingZeros(cache);
+
+      cache <<= zeros + 1;
+      count -= zeros + 1;
+
+      return zeros;
+    }
+};
+
+CompressedPCM::CompressedPCM() {
+  frames = 0;
+  format = { 0, 0, 0 };
+}
+
+void CompressedPCM::encodeBlock(const float *in, uint32_t length, uint32_t channel, uint32_t bits, std::string &out) {
+  std::vector<int32_t> samples((size_t)length * channel);
+  bool bExact = bits >= 1 && bits <= CODEC_MAX_BITS;
+  float scale = bExact ? (float)(1u << (bits - 1)) : 1.f;
+  float limit = (float)(1u << CODEC_MAX_BITS);
+
+  // Scaling by a power of two is exact, so a sample is on the grid when the
+  // scaled value is an integer. Zero of either sign counts as zero. NaN,
+  // infinities and samples far outside full scale fail the range check before
+  // the cast, which keeps every predictor residual within 32 bits.
+  for (size_t i = 0; bExact && i < samples.size(); i++) {
+    float scaled = in[i] * scale;
+
+    bExact = scaled >= -limit && scaled <= limit;
+    samples[i] = bExact ? (int32_t)scaled : 0;
+    bExact = bExact && (float)samples[i] == scaled;
+  }
+
+  if (!bExact) {
+    out.push_back(BLOCK_FLOAT);
+    out.append((const char *)in, (size_t)length * channel * sizeof(float));
+
+    return;
+  }
+
+  out.push_back(BLOCK_RICE);
+
+  BitWriter writer(out);
+  std::vector<uint32_t> residual(length);
+
+  for (uint32_t c = 0; c < channel; c++) {
+    const int32_t *x = samples.data() + c;
+    uint64_t sums[CODEC_MAX_ORDER + 1] = { 0 };
+    uint32_t order = 0;
+
+    // Cost of every fixed predictor in one pass, over the samples all can predict
+    for (uint32_t i = CODEC_MAX_ORDER; i < length; i++) {
+      int64_t s0 = x[i * channel];
+      int64_t s1 = s0 - x[(i - 1) * channel];
+      int64_t s2 = s1 - (x[(i - 1) * channel] - x[(i - 2) * channel]);
+      int64_t s3 = s2 - ((x[(i - 1) * channel] - x[(i - 2) * channel]) - (x[(i - 2) * channel] - x[(i - 3) * channel]));
+      int64_t s4 = x[i * channel] - 4 * (int64_t)x[(i - 1) * channel] + 6 * (int64_t)x[(i - 2) * channel] - 4 * (int64_t)x[(i - 3) * channel] + x[(i - 4) * channel];
+
+      sums[0] += s0 < 0 ? -s0 : s0;
+      sums[1] += s1 < 0 ? -s1 : s1;
+      sums[2] += s2 < 0 ? -s2 : s2;
+      sums[3] += s3 < 0 ? -s3 : s3;
+      sums[4] += s4 < 0 ? -s4 : s4;
+    }
+
+    for (uint32_t o = 1; o <= CODEC_MAX_ORDER && length > CODEC_MAX_ORDER; o++) {
+      order = sums[o] < sums[order] ? o : order;
+    }
+
+    order = order < length ? order : 0;
+
+    uint64_t total = 0;
+
+    for (uint32_t i = order; i < length; i++) {
+      int64_t p;
+
+      switch (order) {
+        case 0:
+          p = 0;
+          break;
+        case 1:
+          p = x[(i - 1) * channel];
+          break;
+        case 2:
+          p = 2 * (int64_t)x[(i - 1) * channel] - x[(i - 2) * channel];
+          break;
+        case 3:
+          p = 3 * (int64_t)x[(i - 1) * channel] - 3 * (int64_t)x[(i - 2) * channel] + x[(i - 3) * channel];
+          break;
+        default:
+          p = 4 * (int64_t)x[(i - 1) * channel] - 6 * (int64_t)x[(i - 2) * channel] + 4 * (int64_t)x[(i - 3) * channel] - x[(i - 4) * channel];
+          break;
+      }
+
+      residual[i] = zigzag((int32_t)(x[i * channel] - p));
+      total += residual[i];
+    }
+
+    // Rice parameter near log2 of the mean
+    uint32_t k = 0;
+    uint64_t count = length - order;
+
+    while (k < 30 && (count << (k + 1)) < total) {
+      k++;
+    }
+
+    writer.write(order, 3);
+    writer.write(k, 5);
+
+    for (uint32_t i = 0; i < order; i++) {
+      writer.write((uint32_t)x[i * channel], 32);
+    }
+
+    for (uint32_t i = order; i < length; i++) {
+      uint32_t q = residual[i] >> k;
+
+      if (q < CODEC_RICE_ESCAPE) {
+        writer.write(1, q + 1);
+        writer.write(residual[i] & ((1u << k) - 1), k);
+      }
+      else {
+        writer.write(1, CODEC_RICE_ESCAPE + 1);
+        writer.write(residual[i], 32);
+      }
+    }
+  }
+
+  writer.flush();
+}
+
+CompressedPCM CompressedPCM::encode(const PCMBuffer &src) {
+  TRACE_SCOPE("encode stimulus");
+  ThreadPool &pool = ThreadPool::getInstance();
+  CompressedPCM result;
+  uint32_t channel = src.getFormat().channel_count;
+  uint64_t blocks = (src.getFrameCount() + CODEC_BLOCK_FRAMES - 1) / CODEC_BLOCK_FRAMES;
+  uint64_t tasks = (blocks + CODEC_TASK_BLOCKS - 1) / CODEC_TASK_BLOCKS;
+  std::vector<std::string> chunks((size_t)tasks);
+  std::vector<std::vector<uint64_t>> sizes((size_t)tasks);
+  TaskGroup group;
+
+  result.frames = src.getFrameCount();
+  result.format = src.getFormat();
+
+  for (uint64_t t = 0; t < tasks; t++) {
+    pool.run(group, [&, t]() {
+      std::vector<float> scratch;
+
+      for (uint64_t b = t * CODEC_TASK_BLOCKS; b < blocks && b < (t + 1) * CODEC_TASK_BLOCKS; b++) {
+        uint64_t first = b * CODEC_BLOCK_FRAMES;
+        uint32_t length = (uint32_t)std::min<uint64_t>(CODEC_BLOCK_FRAMES, result.frames - first);
+        uint64_t available;
+        const float *in = src.getFrames(first, available);
+        size_t before = chunks[t].size();
+
+        // Blocks line up with segments, gather only if one ever doesn't
+        if (available < length) {
+          scratch.resize((size_t)length * channel);
+
+          for (uint32_t done = 0; done < length; done += (uint32_t)available) {
+            in = src.getFrames(first + done, available);
+            available = std::min<uint64_t>(available, length - done);
+            memcpy(scratch.data() + (size_t)done * channel, in, (size_t)available * channel * sizeof(float));
+          }
+
+          in = scratch.data();
+        }
+
+        encodeBlock(in, length, channel, result.format.bitdepth, chunks[t]);
+        sizes[t].push_back(chunks[t].size() - before);
+      }
+    });
+  }
+
+  pool.wait(group);
+
+  std::shared_ptr<Storage> storage = std::make_shared<Storage>();
+  size_t total = 0;
+
+  for (auto &chunk : chunks) {
+    total += chunk.size();
+  }
+
+  storage->bytes.reserve(total + sizeof(uint64_t));
+  storage->offsets.reserve((size_t)blocks + 1);
+
+  for (uint64_t t = 0; t < tasks; t++) {
+    uint64_t offset = storage->bytes.size();
+
+    for (auto size : sizes[t]) {
+      storage->offsets.push_back(offset);
+      offset += size;
+    }
+
+    storage->bytes.append(chunks[t]);
+    std::string().swap(chunks[t]);
+  }
+
+  storage->offsets.push_back(storage->bytes.size());
+
+  // Room for the reader to run ahead of the last bit
+  storage->bytes.append(sizeof(uint64_t), '\0');
+  result.storage = storage;
+
+  return result;
+}
+
+uint32_t CompressedPCM::decode(uint64_t block, float *out) const {
+  uint32_t channel = format.channel_count;
+  uint32_t length = (uint32_t)std::min<uint64_t>(CODEC_BLOCK_FRAMES, frames - block * CODEC_BLOCK_FRAMES);
+  const uint8_t *data = (const uint8_t *)storage->bytes.data() + storage->offsets[(size_t)block];
+
+  if (data[0] == BLOCK_FLOAT) {
+    memcpy(out, data + 1, (size_t)length * channel * sizeof(float));
+
+    return length;
+  }
+
+  BitReader reader(data + 1);
+  float inverse = 1.f / (float)(1u << (format.bitdepth - 1));
+
+  for (uint32_t c = 0; c < channel; c++) {
+    float *y = out + c;
+    uint32_t order = reader.read(3);
+    uint32_t k = reader.read(5);
+    int32_t x1 = 0, x2 = 0, x3 = 0, x4 = 0;
+
+    for (uint32_t i = 0; i < order; i++) {
+      int32_t value = (int32_t)reader.read(32);
+
+      x4 = x3;
+      x3 = x2;
+      x2 = x1;
+      x1 = value;
+      y[i * channel] = value * inverse;
+    }
+
+    // History kept in registers, one predictor per loop
+    for (uint32_t i = order; i < length; i++) {
+      uint32_t q = reader.readUnary();
+      uint32_t u = q < CODEC_RICE_ESCAPE ? (q << k) | reader.read(k) : reader.read(32);
+      int32_t r = unzigzag(u);
+      int32_t value;
+
+      switch (order) {
+        case 0:
+          value = r;
+          break;
+        case 1:
+          value = r + x1;
+          break;
+        case 2:
+          value = r + 2 * x1 - x2;
+          break;
+        case 3:
+          value = r + 3 * x1 - 3 * x2 + x3;
+          break;
+        default:
+          value = r + 4 * x1 - 6 * x2 + 4 * x3 - x4;
+          break;
+      }
+
+      x4 = x3;
+      x3 = x2;
+      x2 = x1;
+      x1 = value;
+      y[i * channel] = value * inverse;
+    }
+  }
+
+  return length;
+}
+
+bool CompressedPCM::empty() const {
+  return !storage;
+}
+
+uint64_t CompressedPCM::getBlockCount() const {
+  return storage ? storage->offsets.size() - 1 : 0;
+}
+
+const PCMFormat &CompressedPCM::getFormat() const {
+  return format;
+}
+
+uint64_t CompressedPCM::getFrameCount() const {
+  return frames;
+}
+
+size_t CompressedPCM::getBytes() const {
+  return storage ? storage->bytes.size() + storage->offsets.size() * sizeof(uint64_t) : 0;
+}
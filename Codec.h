@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "Buffer.h"
+
+#define CODEC_BLOCK_FRAMES    SEGMENT_GUARD_FRAMES    // one block is exactly a guard
+#define CODEC_MAX_ORDER       4
+#define CODEC_RICE_ESCAPE     24                      // longer quotients store the value raw
+#define CODEC_MAX_BITS        24                      // deeper samples aren't exact in float
+#define CODEC_TASK_BLOCKS     64                      // blocks per encoding task
+
+// Stimuli as they are kept in memory, losslessly compressed in independent
+// blocks (FLAC style fixed predictors with Rice coded residuals). Samples on
+// the bitdepth's grid are coded as their integer values, a block with any
+// other sample is stored as plain floats. Immutable and shared like PCMBuffer.
+class CompressedPCM {
+  private:
+    struct Storage {
+      std::string bytes;
+      std::vector<uint64_t> offsets;    // block starts, bytes.size() last
+    };
+
+    std::shared_ptr<const Storage> storage;
+    uint64_t frames;
+    PCMFormat format;
+
+    static void encodeBlock(const float *, uint32_t, uint32_t, uint32_t, std::string &);
+
+  public:
+    CompressedPCM();
+
+    static CompressedPCM encode(const PCMBuffer &);
+
+    bool empty() const;
+
+    // Whole block into interleaved floats, returns its frame count
+    uint32_t decode(uint64_t, float *) const;
+
+    uint64_t getBlockCount() const;
+    const PCMFormat &getFormat() const;
+    uint64_t getFrameCount() const;
+    size_t getBytes() const;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "Convert.h"
+#include "Dispatch.h"
+
+#include <string.h>
+
+// Implementations live in Kernels*.cpp and are picked by Dispatch at startup
+
+void Convert::fromInt32(const int32_t *src, float *dst, size_t count) {
+  Dispatch::kernels().fromInt32(src, dst, count);
+}
+
+void Convert::quantize(const float *src, float *dst, size_t count, float gain, uint32_t bits) {
+  Dispatch::kernels().quantize(src, dst, count, gain, bits);
+}
+
+void Convert::toInt32(const float *src, void *dst, size_t count) {
+  Dispatch::kernels().toInt32(src, dst, count);
+}
+
+void Convert::toInt24(const float *src, void *dst, size_t count) {
+  Dispatch::kernels().toInt24(src, dst, count);
+}
+
+void Convert::toInt16(const float *src, void *dst, size_t count) {
+  Dispatch::kernels().toInt16(src, dst, count);
+}
+
+void Convert::toUInt8(const float *src, void *dst, size_t count) {
+  Dispatch::kernels().toUInt8(src, dst, count);
+}
+
+void Convert::toFloat32(const float *src, void *dst, size_t count) {
+  memcpy(dst, src, count * sizeof(float));
+}
+
+// Sample types, one load of a fixed size per sample
+
+struct FormatU8 {
+  static const size_t size = 1;
+
+  static inline float load(const uint8_t *p) {
+    return (p[0] - 0x80) * (1.f / 128.f);
+  }
+};
+
+struct FormatS16 {
+  static const size_t size = 2;
+
+  static inline float load(const uint8_t *p) {
+    int16_t x;
+
+    memcpy(&x, p, size);
+
+    return x * (1.f / 32768.f);
+  }
+};
+
+struct FormatS32 {
+  static const size_t size = 4;
+
+  static inline float load(const uint8_t *p) {
+    int32_t x;
+
+    memcpy(&x, p, size);
+
+    return x * (1.f / SAMPLE_SCALE_32BIT);
+  }
+};
+
+struct FormatF32 {
+  static const size_t size = 4;
+
+  static inline float load(const uint8_t *p) {
+    float x;
+
+    memcpy(&x, p, size);
+
+    return x;
+  }
+};
+
+struct FormatF64 {
+  static const size_t size = 8;
+
+  static inline float load(const uint8_t *p) {
+    double x;
+
+    memcpy(&x, p, size);
+
+    return (float)x;
+  }
+};
+
+// CH is the channel count, 0 takes it at runtime
+
+template <class F, uint32_t CH>
+static void inputInterleaved(const uint8_t *const *planes, float *dst, size_t frames, uint32_t channel) {
+  const uint32_t ch = CH ? CH : channel;
+  const uint8_t *src = planes[0];
+  size_t count = frames * ch;
+
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = F::load(src + i * F::size);
+  }
+}
+
+template <class F, uint32_t CH>
+static void inputPlanar(const uint8_t *const *planes, float *dst, size_t frames, uint32_t channel) {
+  if (CH) {
+    for (size_t i = 0; i < frames; i++) {
+      for (uint32_t c = 0; c < CH; c++) {
+        dst[i * CH + c] = F::load(planes[c] + i * F::size);
+      }
+    }
+  }
+  else {
+    // Plane by plane, reads stay sequential
+    for (uint32_t c = 0; c < channel; c++) {
+      const uint8_t *src = planes[c];
+
+      for (size_t i = 0; i < frames; i++) {
+        dst[i * channel + c] = F::load(src + i * F::size);
+      }
+    }
+  }
+}
+
+// The common 24bit case goes through the dispatched SIMD kernel
+static void inputS32(const uint8_t *const *planes, float *dst, size_t frames, uint32_t channel) {
+  Dispatch::kernels().fromInt32((const int32_t *)planes[0], dst, frames * channel);
+}
+
+#define INPUT_ROW(F)  { { inputInterleaved<F, 1>, inputInterleaved<F, 2>, inputInterleaved<F, 0> }, \
+                        { inputPlanar<F, 1>, inputPlanar<F, 2>, inputPlanar<F, 0> } }
+
+static const Convert::InputFunc inputs[SAMPLE_TYPE_COUNT][2][3] = {
+  INPUT_ROW(FormatU8),
+  INPUT_ROW(FormatS16),
+  { { inputS32, inputS32, inputS32 }, { inputPlanar<FormatS32, 1>, inputPlanar<FormatS32, 2>, inputPlanar<FormatS32, 0> } },
+  INPUT_ROW(FormatF32),
+  INPUT_ROW(FormatF64),
+};
+
+Convert::InputFunc Convert::getInput(SampleType type, bool bPlanar, uint32_t channel) {
+  if (type >= SAMPLE_TYPE_COUNT || channel == 0) {
+    return NULL;
+  }
+
+  return inputs[type][bPlanar ? 1 : 0][channel <= 2 ? channel - 1 : 2];
+}
+
+template <uint32_t CH>
+static void decimate(const float *src, float *dst, size_t frames, uint32_t step, uint32_t channel) {
+  const uint32_t ch = CH ? CH : channel;
+
+  for (size_t i = 0; i < frames; i++) {
+    for (uint32_t c = 0; c < ch; c++) {
+      dst[i * ch + c] = src[i * step * ch + c];
+    }
+  }
+}
+
+Convert::DecimateFunc Convert::getDecimate(uint32_t channel) {
+  switch (channel) {
+    case 1:
+      return decimate<1>;
+    case 2:
+      return decimate<2>;
+    default:
+      return decimate<0>;
+  }
+}
+
+Convert::OutputFunc Convert::getOutput(uint32_t byte_per_sample, bool bFloat) {
+  const KernelTable &kernels = Dispatch::kernels();
+
+  // Bound directly so the callback skips the wrapper
+  if (bFloat) {
+    return toFloat32;
+  }
+
+  switch (byte_per_sample) {
+    case 1:
+      return kernels.toUInt8;
+    case 2:
+      return kernels.toInt16;
+    case 3:
+      return kernels.toInt24;
+    default:
+      return kernels.toInt32;
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef _CONVERT_H_
+#define _CONVERT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SAMPLE_SCALE_24BIT    8388608.f       // 2^23
+#define SAMPLE_SCALE_32BIT    2147483648.f    // 2^31
+#define SAMPLE_MAX_32BIT      2147483520.f    // largest float below 2^31
+
+// Decoder side sample types, each one interleaved or planar
+enum SampleType {
+  SAMPLE_U8,
+  SAMPLE_S16,
+  SAMPLE_S32,
+  SAMPLE_F32,
+  SAMPLE_F64,
+  SAMPLE_TYPE_COUNT
+};
+
+// Sample format kernels. Audio is kept as interleaved float32 in [-1, 1)
+// everywhere inside SongSession, integers only exist at the decoder input
+// and at the device output.
+class Convert {
+  public:
+    typedef void (*OutputFunc)(const float *, void *, size_t);
+    typedef void (*InputFunc)(const uint8_t *const *, float *, size_t, uint32_t);
+    typedef void (*DecimateFunc)(const float *, float *, size_t, uint32_t, uint32_t);
+
+    // Decoder edge
+    static void fromInt32(const int32_t *, float *, size_t);
+
+    // Planes (one for interleaved) to interleaved float, picked once per
+    // stream. Specialized for mono and stereo, NULL if the type is unknown.
+    static InputFunc getInput(SampleType, bool, uint32_t);
+
+    // Keep every step-th frame, specialized by channel count like getInput
+    static DecimateFunc getDecimate(uint32_t);
+
+    // Gain, then round onto a bits-deep grid (truncating below 24 bits)
+    static void quantize(const float *, float *, size_t, float, uint32_t);
+
+    // Device edge, scale + clip + round + pack in one pass
+    static void toInt32(const float *, void *, size_t);
+    static void toInt24(const float *, void *, size_t);
+    static void toInt16(const float *, void *, size_t);
+    static void toUInt8(const float *, void *, size_t);
+    static void toFloat32(const float *, void *, size_t);
+
+    static OutputFunc getOutput(uint32_t, bool);
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "Dispatch.h"
+
+#include <algorithm>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DISPATCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+KernelTable Dispatch::table;
+uint32_t Dispatch::features = 0;
+std::string Dispatch::report;
+
+#ifdef DISPATCH_X86
+static void cpuid(uint32_t leaf, uint32_t sub, uint32_t regs[4]) {
+#ifdef _MSC_VER
+  __cpuidex((int *)regs, (int)leaf, (int)sub);
+#else
+  if (!__get_cpuid_count(leaf, sub, &regs[0], &regs[1], &regs[2], &regs[3])) {
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+  }
+#endif
+}
+
+static uint64_t xgetbv() {
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  uint32_t lo, hi;
+
+  __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+
+  return (uint64_t)hi << 32 | lo;
+#endif
+}
+#endif
+
+uint32_t Dispatch::detect() {
+  uint32_t result = 0;
+
+#ifdef DISPATCH_X86
+  uint32_t regs[4];
+
+  cpuid(0, 0, regs);
+  uint32_t max_leaf = regs[0];
+
+  cpuid(1, 0, regs);
+
+  if (regs[3] & (1u << 26)) {
+    result |= CPU_SSE2;
+  }
+
+  // AVX state has to be enabled by the OS too, not only present in the CPU
+  bool osxsave = (regs[2] & (1u << 27)) != 0;
+  bool fma = (regs[2] & (1u << 12)) != 0;
+  uint64_t xcr0 = osxsave ? xgetbv() : 0;
+
+  if (max_leaf >= 7 && (xcr0 & 0x6) == 0x6) {
+    cpuid(7, 0, regs);
+
+    if ((regs[1] & (1u << 5)) && fma) {
+      result |= CPU_AVX2;
+    }
+    if ((regs[1] & (1u << 16)) && (xcr0 & 0xE6) == 0xE6) {
+      result |= CPU_AVX512;
+    }
+  }
+#endif
+
+  return result;
+}
+
+bool Dispatch::verify(const KernelTable &test, const KernelTable &reference, std::string &error) {
+  const size_t count = DISPATCH_TEST_SIZE;
+  std::vector<int32_t> ints(count);
+  std::vector<float> in(count * 3);
+  std::vector<float> a(count * 3), b(count * 3);
+  std::vector<char> x(count * 4), y(count * 4);
+
+  // Fixed seed, slightly past full scale so clipping is covered
+  uint32_t seed = 0x12345678;
+
+  for (size_t i = 0; i < count; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    ints[i] = (int32_t)seed;
+  }
+  for (size_t i = 0; i < in.size(); i++) {
+    seed = seed * 1664525u + 1013904223u;
+    in[i] = ((seed >> 8) / 16777216.f * 2.f - 1.f) * 1.05f;
+  }
+
+  test.fromInt32(ints.data(), a.data(), count);
+  reference.fromInt32(ints.data(), b.data(), count);
+
+  if (memcmp(a.data(), b.data(), count * sizeof(float)) != 0) {
+    error = "fromInt32";
+    return false;
+  }
+
+  uint32_t bits[] = { 24, 16, 8 };
+  float gains[] = { 1.f, 0.7071f };
+
+  for (auto bit : bits) {
+    for (auto gain : gains) {
+      test.quantize(in.data(), a.data(), count, gain, bit);
+      reference.quantize(in.data(), b.data(), count, gain, bit);
+
+      if (memcmp(a.data(), b.data(), count * sizeof(float)) != 0) {
+        error = "quantize";
+        return false;
+      }
+    }
+  }
+
+  struct {
+    const char *name;
+    void (*run)(const float *, void *, size_t);
+    void (*expect)(const float *, void *, size_t);
+    size_t size;
+  } outputs[] = {
+    { "toInt32", test.toInt32, reference.toInt32, 4 },
+    { "toInt24", test.toInt24, reference.toInt24, 3 },
+    { "toInt16", test.toInt16, reference.toInt16, 2 },
+    { "toUInt8", test.toUInt8, reference.toUInt8, 1 },
+  };
+
+  for (auto &output : outputs) {
+    output.run(in.data(), x.data(), count);
+    output.expect(in.data(), y.data(), count);
+
+    if (memcmp(x.data(), y.data(), count * output.size) != 0) {
+      error = output.name;
+      return false;
+    }
+  }
+
+  // Summation order differs, so compare against the magnitude of the terms
+  for (uint32_t channel = 1; channel <= 3; channel++) {
+    for (uint32_t taps = 61; taps <= 64; taps++) {
+      float out_test[3], out_ref[3];
+
+      test.fir(in.data() + count, in.data(), taps, channel, out_test);
+      reference.fir(in.data() + count, in.data(), taps, channel, out_ref);
+
+      for (uint32_t c = 0; c < channel; c++) {
+        float magnitude = 0.f;
+
+        for (uint32_t j = 0; j < taps; j++) {
+          magnitude += fabsf(in[count + j] * in[j * channel + c]);
+        }
+
+        if (fabsf(out_test[c] - out_ref[c]) > 1e-5f * magnitude) {
+          error = "fir";
+          return false;
+        }
+      }
+    }
+  }
+
+  // Fused multiply-add rounds once less, same bound as the filter
+  size_t halves[] = { 1, 3, 4, 7, 8, 9, count / 4 };
+
+  for (auto half : halves) {
+    const float *wr = in.data() + count * 2;
+    const float *wi = wr + half;
+
+    std::copy(in.begin(), in.begin() + half * 4, a.begin());
+    std::copy(in.begin(), in.begin() + half * 4, b.begin());
+
+    test.butterfly(a.data(), a.data() + half, a.data() + half * 2, a.data() + half * 3, wr, wi, half);
+    reference.butterfly(b.data(), b.data() + half, b.data() + half * 2, b.data() + half * 3, wr, wi, half);
+
+    for (size_t k = 0; k < half; k++) {
+      float magnitude = fabsf(in[k]) + fabsf(in[half + k]) + (fabsf(in[half * 2 + k]) + fabsf(in[half * 3 + k])) * (fabsf(wr[k]) + fabsf(wi[k]));
+
+      for (size_t part = 0; part < 4; part++) {
+        if (fabsf(a[half * part + k] - b[half * part + k]) > 1e-5f * magnitude) {
+          error = "butterfly";
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+void Dispatch::init() {
+  KernelTable reference;
+  KernelTable candidate;
+  std::string error;
+  std::string failed;
+  uint32_t allowed = CPU_SSE2 | CPU_AVX2;
+  const char *cap = getenv(DISPATCH_ENV);
+
+  features = detect();
+
+  // Lets a station be pinned to a lower level when comparing results
+  if (cap) {
+    if (strcmp(cap, "scalar") == 0) {
+      allowed = 0;
+    }
+    else if (strcmp(cap, "sse2") == 0) {
+      allowed = CPU_SSE2;
+    }
+  }
+
+  Kernels::bindScalar(reference);
+  table = reference;
+  report = reference.name;
+
+  void (*levels[])(KernelTable &) = { Kernels::bindAVX2, Kernels::bindSSE2 };
+  uint32_t required[] = { CPU_AVX2, CPU_SSE2 };
+
+  for (int i = 0; i < 2; i++) {
+    if ((features & allowed & required[i]) != required[i]) {
+      continue;
+    }
+
+    levels[i](candidate);
+
+    if (verify(candidate, reference, error)) {
+      table = candidate;
+      report = candidate.name;
+      break;
+    }
+
+    // Never ship a kernel which disagrees with the reference, fall back a
+    // level. Shown in the title bar, GUI builds have no console.
+    failed.append(failed.empty() ? " (" : ", ").append(candidate.name).append(" ").append(error).append(" failed self-test");
+  }
+
+  if (!failed.empty()) {
+    report.append(failed).append(")");
+  }
+  if (features & CPU_AVX512) {
+    report.append(" (AVX-512 present)");
+  }
+}
+
+uint32_t Dispatch::getFeatures() {
+  return features;
+}
+
+const std::string &Dispatch::getReport() {
+  return report;
+}
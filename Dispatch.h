@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef _DISPATCH_H_
+#define _DISPATCH_H_
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DISPATCH_X86
+#endif
+
+#define CPU_SSE2            0x01
+#define CPU_AVX2            0x02    // with FMA
+#define CPU_AVX512          0x04
+
+#define DISPATCH_ENV        "LISTENING_TEST_CPU"  // scalar, sse2 or avx2 to cap the level
+#define DISPATCH_TEST_SIZE  4099                  // odd on purpose, exercises the tails
+
+// Every vectorized kernel family, bound once to the best implementation
+struct KernelTable {
+  const char *name;
+
+  void (*fromInt32)(const int32_t *, float *, size_t);
+  void (*quantize)(const float *, float *, size_t, float, uint32_t);
+
+  void (*toInt32)(const float *, void *, size_t);
+  void (*toInt24)(const float *, void *, size_t);
+  void (*toInt16)(const float *, void *, size_t);
+  void (*toUInt8)(const float *, void *, size_t);
+
+  // out[c] = sum of coef[j] * in[j * channel + c], in points at the oldest frame
+  void (*fir)(const float *, const float *, uint32_t, uint32_t, float *);
+
+  // Radix-2 butterflies in place, (a, b) becomes (a + w * b, a - w * b) per element
+  void (*butterfly)(float *, float *, float *, float *, const float *, const float *, size_t);
+};
+
+class Kernels {
+  public:
+    static void bindScalar(KernelTable &);
+    static void bindSSE2(KernelTable &);
+    static void bindAVX2(KernelTable &);
+};
+
+class Dispatch {
+  private:
+    static KernelTable table;
+    static uint32_t features;
+    static std::string report;
+
+    static uint32_t detect();
+    static bool verify(const KernelTable &, const KernelTable &, std::string &);
+
+  public:
+    static void init();
+
+    static const KernelTable &kernels() { return table; }
+    static uint32_t getFeatures();
+    static const std::string &getReport();
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include "Feeder.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+PCMRing::PCMRing(const CompressedPCM &_data) {
+  data = _data;
+  slot_frames = (uint64_t)RING_SLOT_BLOCKS * CODEC_BLOCK_FRAMES;
+  stride = slot_frames + CODEC_BLOCK_FRAMES;
+  storage.resize((size_t)(RING_SLOTS * stride * data.getFormat().channel_count));
+  misses = 0;
+
+  for (auto &tag : tags) {
+    tag = RING_NONE;
+  }
+  for (auto &pin : pins) {
+    pin = RING_NONE;
+  }
+}
+
+void PCMRing::pin(int index, uint64_t frame) {
+  pins[index].store(frame == RING_NONE ? RING_NONE : frame / slot_frames);
+}
+
+bool PCMRing::isProtected(uint64_t slot) {
+  // The read slot, the one before for filter history and the next one for
+  // the rest of the buffer
+  for (auto &pin : pins) {
+    uint64_t pinned = pin.load();
+
+    if (pinned != RING_NONE && slot + 1 >= pinned && slot <= pinned + 1) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void PCMRing::fill(uint32_t index, uint64_t slot) {
+  TRACE_SCOPE("feed slot");
+  uint32_t channel = data.getFormat().channel_count;
+  float *out = storage.data() + (size_t)index * stride * channel;
+  uint64_t first = slot * RING_SLOT_BLOCKS;
+  uint64_t done = 0;
+
+  // The slot's blocks and the first block of the next one as the guard
+  for (uint64_t b = first; b <= first + RING_SLOT_BLOCKS && b < data.getBlockCount(); b++) {
+    done += data.decode(b, out + (size_t)done * channel);
+  }
+
+  memset(out + (size_t)done * channel, 0, (size_t)(stride - done) * channel * sizeof(float));
+}
+
+bool PCMRing::feed() {
+  uint64_t slot_count = (data.getFrameCount() + slot_frames - 1) / slot_frames;
+  std::vector<uint64_t> wanted;
+
+  // Most urgent first: every pinned slot, then the ones after it, then the
+  // one before, then further ahead
+  for (int distance = 0; distance <= RING_AHEAD + 1; distance++) {
+    for (auto &pin : pins) {
+      uint64_t pinned = pin.load();
+      uint64_t slot;
+
+      if (pinned == RING_NONE) {
+        continue;
+      }
+
+      if (distance == 2) {
+        if (pinned == 0) {
+          continue;
+        }
+
+        slot = pinned - 1;
+      }
+      else {
+        slot = pinned + (distance < 2 ? distance : distance - 1);
+      }
+
+      if (slot < slot_count && std::find(wanted.begin(), wanted.end(), slot) == wanted.end()) {
+        wanted.push_back(slot);
+      }
+    }
+  }
+
+  for (auto slot : wanted) {
+    bool bPresent = false;
+
+    for (auto &tag : tags) {
+      bPresent = bPresent || tag.load() == slot;
+    }
+
+    if (bPresent) {
+      continue;
+    }
+
+    // Reuse an empty slot, or one nobody wants
+    int victim = -1;
+
+    for (int i = 0; i < RING_SLOTS && victim < 0; i++) {
+      victim = tags[i].load() == RING_NONE ? i : -1;
+    }
+    for (int i = 0; i < RING_SLOTS && victim < 0; i++) {
+      victim = std::find(wanted.begin(), wanted.end(), tags[i].load()) == wanted.end() ? i : -1;
+    }
+
+    if (victim < 0) {
+      return false;
+    }
+
+    uint64_t previous = tags[victim].exchange(RING_NONE);
+
+    // A pin may have moved onto it since the wanted list was made
+    if (previous != RING_NONE && isProtected(previous)) {
+      tags[victim].store(previous);
+      return false;
+    }
+
+    fill((uint32_t)victim, slot);
+    tags[victim].store(slot);
+
+    return true;
+  }
+
+  return false;
+}
+
+const float *PCMRing::getFrames(uint64_t first, uint64_t &available) const {
+  uint64_t slot = first / slot_frames;
+
+  if (first < data.getFrameCount()) {
+    for (uint32_t i = 0; i < RING_SLOTS; i++) {
+      if (tags[i].load() == slot) {
+        available = std::min(slot * slot_frames + stride, data.getFrameCount()) - first;
+
+        return storage.data() + (size_t)(i * stride + first - slot * slot_frames) * data.getFormat().channel_count;
+      }
+    }
+
+    misses.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  available = 0;
+
+  return NULL;
+}
+
+const PCMFormat &PCMRing::getFormat() const {
+  return data.getFormat();
+}
+
+uint64_t PCMRing::getFrameCount() const {
+  return data.getFrameCount();
+}
+
+const char *PCMRing::getStorage(size_t &size) const {
+  size = storage.size() * sizeof(float);
+
+  return (const char *)storage.data();
+}
+
+bool PCMRing::isReady(uint64_t frame) const {
+  uint64_t slot = frame / slot_frames;
+
+  if (frame >= data.getFrameCount()) {
+    return true;
+  }
+
+  for (auto &tag : tags) {
+    if (tag.load() == slot) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+uint64_t PCMRing::getMisses() const {
+  return misses.load(std::memory_order_relaxed);
+}
+
+// Feeder
+
+Feeder::Feeder() {
+  busy = NULL;
+  bWake = false;
+  bExit = false;
+  worker = std::thread(&Feeder::workerMain, this);
+}
+
+Feeder::~Feeder() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    bExit = true;
+  }
+
+  cond.notify_all();
+  worker.join();
+}
+
+Feeder &Feeder::getInstance() {
+  static Feeder instance;
+
+  return instance;
+}
+
+void Feeder::add(PCMRing *ring) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  rings.push_back(ring);
+  bWake = true;
+  cond.notify_all();
+}
+
+void Feeder::remove(PCMRing *ring) {
+  std::unique_lock<std::mutex> guard(lock);
+
+  rings.erase(std::remove(rings.begin(), rings.end(), ring), rings.end());
+
+  // A slot of it may be decoding right now, the ring is freed after this
+  cond.wait(guard, [&]() { return busy != ring; });
+}
+
+void Feeder::wake() {
+  std::lock_guard<std::mutex> guard(lock);
+
+  bWake = true;
+  cond.notify_all();
+}
+
+void Feeder::workerMain() {
+  Trace::setThreadName("feeder");
+
+  std::unique_lock<std::mutex> guard(lock);
+
+  while (!bExit) {
+    bool bFed = false;
+
+    // One slot per ring and pass, so a seek on one station can't starve another
+    pass.assign(rings.begin(), rings.end());
+
+    for (auto ring : pass) {
+      // Removed while another ring was being fed
+      if (std::find(rings.begin(), rings.end(), ring) == rings.end()) {
+        continue;
+      }
+
+      // Decoded unlocked, so add, remove and wake never wait on a slot of
+      // another ring
+      busy = ring;
+      guard.unlock();
+
+      bFed = ring->feed() || bFed;
+
+      guard.lock();
+      busy = NULL;
+      cond.notify_all();
+    }
+
+    // The callback can't signal, pins are polled while a ring is registered,
+    // that is while a stream is open. Otherwise only add or exit wake it.
+    if (!bFed) {
+      auto woken = [&]() { return bWake || bExit; };
+
+      if (rings.empty()) {
+        cond.wait(guard, woken);
+      }
+      else {
+        cond.wait_for(guard, std::chrono::milliseconds(FEEDER_POLL_MS), woken);
+      }
+
+      bWake = false;
+    }
+  }
+}
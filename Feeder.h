@@ -0,0 +1,91 @@
+#pragma once
+
+#ifndef _FEEDER_H_
+#define _FEEDER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "Buffer.h"
+#include "Codec.h"
+
+#define RING_SLOTS            12
+#define RING_SLOT_BLOCKS      8           // codec blocks per slot, plus one for the guard
+#define RING_AHEAD            3           // slots decoded past the one being read
+#define RING_NONE             UINT64_MAX
+#define FEEDER_POLL_MS        5           // pin polling while any ring is registered
+
+#define RING_PIN_PLAY         0           // where the callback reads
+#define RING_PIN_FADE         1           // where a crossfade reads the old position
+#define RING_PIN_SEEK         2           // posted by the UI ahead of a seek
+#define RING_PIN_COUNT        3
+
+// Decoded window of a compressed stimulus around the playhead. Slots are
+// filled by the feeder thread, the callback only looks them up. The callback
+// pins a frame before it reads around it and the feeder never reuses a slot
+// near a pin: the feeder clears a slot's tag before it checks the pins and
+// the callback pins before it checks the tags, both sequentially consistent,
+// so one of them always sees the other.
+class PCMRing : public PCMSource {
+  private:
+    CompressedPCM data;
+    uint64_t slot_frames;
+    uint64_t stride;                      // frames per slot with the guard
+    std::vector<float> storage;
+    std::atomic<uint64_t> tags[RING_SLOTS];
+    std::atomic<uint64_t> pins[RING_PIN_COUNT];
+    mutable std::atomic<uint64_t> misses;
+
+    bool isProtected(uint64_t);
+    void fill(uint32_t, uint64_t);
+
+  public:
+    PCMRing(const CompressedPCM &);
+
+    // Source frame, or RING_NONE to release
+    void pin(int, uint64_t);
+
+    // Feeder side, decodes the most urgent missing slot. False when none is.
+    bool feed();
+
+    const float *getFrames(uint64_t, uint64_t &) const override;
+    const PCMFormat &getFormat() const override;
+    uint64_t getFrameCount() const override;
+
+    // Whether the slot holding a frame is decoded, not counted as a miss
+    bool isReady(uint64_t) const;
+
+    const char *getStorage(size_t &) const;
+    uint64_t getMisses() const;           // since the ring was made
+};
+
+// One thread keeping every ring of the process decoded ahead
+class Feeder {
+  private:
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable cond;
+    std::vector<PCMRing *> rings;
+    std::vector<PCMRing *> pass;          // rings of the current pass
+    PCMRing *busy;                        // being fed, outside the lock
+    bool bWake;
+    bool bExit;
+
+    Feeder();
+    ~Feeder();
+
+    void workerMain();
+
+  public:
+    static Feeder &getInstance();
+
+    void add(PCMRing *);
+    void remove(PCMRing *);
+    void wake();
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "Hash.h"
+
+#include <string.h>
+
+#define PRIME64_1   0x9E3779B185EBCA87ull
+#define PRIME64_2   0xC2B2AE3D27D4EB4Full
+#define PRIME64_3   0x165667B19E3779F9ull
+#define PRIME64_4   0x85EBCA77C2B2AE63ull
+#define PRIME64_5   0x27D4EB2F165667C5ull
+
+static inline uint64_t rotl(uint64_t value, uint32_t bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// Little endian like every platform this builds for
+static inline uint64_t read64(const uint8_t *p) {
+  uint64_t value;
+
+  memcpy(&value, p, sizeof(value));
+
+  return value;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t value;
+
+  memcpy(&value, p, sizeof(value));
+
+  return value;
+}
+
+static inline uint64_t mixRound(uint64_t acc, uint64_t input) {
+  acc += input * PRIME64_2;
+  acc = rotl(acc, 31);
+
+  return acc * PRIME64_1;
+}
+
+static inline uint64_t merge(uint64_t acc, uint64_t value) {
+  acc ^= mixRound(0, value);
+
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+XXHash64::XXHash64(uint64_t _seed) {
+  reset(_seed);
+}
+
+void XXHash64::reset(uint64_t _seed) {
+  seed = _seed;
+  acc[0] = seed + PRIME64_1 + PRIME64_2;
+  acc[1] = seed + PRIME64_2;
+  acc[2] = seed;
+  acc[3] = seed - PRIME64_1;
+  total = 0;
+  pending_size = 0;
+}
+
+void XXHash64::update(const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  const uint8_t *end = p + size;
+
+  total += size;
+
+  // Finish a stripe started by the previous call
+  if (pending_size > 0) {
+    size_t take = 32 - pending_size < size ? 32 - pending_size : size;
+
+    memcpy(pending + pending_size, p, take);
+    pending_size += (uint32_t)take;
+    p += take;
+
+    if (pending_size < 32) {
+      return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+      acc[i] = mixRound(acc[i], read64(pending + i * 8));
+    }
+
+    pending_size = 0;
+  }
+
+  for (; end - p >= 32; p += 32) {
+    acc[0] = mixRound(acc[0], read64(p));
+    acc[1] = mixRound(acc[1], read64(p + 8));
+    acc[2] = mixRound(acc[2], read64(p + 16));
+    acc[3] = mixRound(acc[3], read64(p + 24));
+  }
+
+  memcpy(pending, p, end - p);
+  pending_size = (uint32_t)(end - p);
+}
+
+uint64_t XXHash64::digest() const {
+  uint64_t h;
+
+  if (total >= 32) {
+    h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+
+    for (int i = 0; i < 4; i++) {
+      h = merge(h, acc[i]);
+    }
+  }
+  else {
+    h = seed + PRIME64_5;
+  }
+
+  h += total;
+
+  const uint8_t *p = pending;
+  const uint8_t *end = pending + pending_size;
+
+  for (; end - p >= 8; p += 8) {
+    h ^= mixRound(0, read64(p));
+    h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+
+  if (end - p >= 4) {
+    h ^= read32(p) * PRIME64_1;
+    h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+
+  for (; p < end; p++) {
+    h ^= *p * PRIME64_5;
+    h = rotl(h, 11) * PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+uint64_t XXHash64::hash(const void *data, size_t size, uint64_t seed) {
+  XXHash64 state(seed);
+
+  state.update(data, size);
+
+  return state.digest();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming xxHash64. Fixed size state and no allocation, so the audio
+// callback can feed it every buffer.
+class XXHash64 {
+  private:
+    uint64_t acc[4];
+    uint64_t seed;
+    uint64_t total;
+    uint8_t pending[32];
+    uint32_t pending_size;
+
+  public:
+    XXHash64(uint64_t = 0);
+
+    void reset(uint64_t = 0);
+    void update(const void *, size_t);
+    uint64_t digest() const;
+
+    static uint64_t hash(const void *, size_t, uint64_t = 0);
+};
+
+#endif
@@ -0,0 +1,300 @@
+#include "Dispatch.h"
+#include "Convert.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifdef DISPATCH_X86
+#include <emmintrin.h>
+#endif
+
+static inline float clip(float x, float lo, float hi) {
+  return x < lo ? lo : (x > hi ? hi : x);
+}
+
+// Scalar reference, every other implementation is checked against these
+
+static void fromInt32Scalar(const int32_t *src, float *dst, size_t count) {
+  const float scale = 1.f / SAMPLE_SCALE_32BIT;
+
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = src[i] * scale;
+  }
+}
+
+static void quantizeScalar(const float *src, float *dst, size_t count, float gain, uint32_t bits) {
+  // Same result as rounding to 24bit integer, applying gain and shifting down
+  const float scale = gain * SAMPLE_SCALE_24BIT;
+  const float inverse = 1.f / (1u << (bits - 1));
+  const int shift = 24 - bits;
+
+  for (size_t i = 0; i < count; i++) {
+    int32_t q = (int32_t)lrintf(clip(src[i] * scale, -SAMPLE_SCALE_24BIT, SAMPLE_SCALE_24BIT - 1.f));
+
+    dst[i] = (q >> shift) * inverse;
+  }
+}
+
+static void toInt32Scalar(const float *src, void *dst, size_t count) {
+  int32_t *out = (int32_t *)dst;
+
+  for (size_t i = 0; i < count; i++) {
+    out[i] = (int32_t)lrintf(clip(src[i] * SAMPLE_SCALE_32BIT, -SAMPLE_SCALE_32BIT, SAMPLE_MAX_32BIT));
+  }
+}
+
+static void toInt24Scalar(const float *src, void *dst, size_t count) {
+  unsigned char *out = (unsigned char *)dst;
+
+  for (size_t i = 0; i < count; i++, out += 3) {
+    int32_t q = (int32_t)lrintf(clip(src[i] * SAMPLE_SCALE_24BIT, -SAMPLE_SCALE_24BIT, SAMPLE_SCALE_24BIT - 1.f));
+
+    out[0] = (unsigned char)q;
+    out[1] = (unsigned char)(q >> 8);
+    out[2] = (unsigned char)(q >> 16);
+  }
+}
+
+static void toInt16Scalar(const float *src, void *dst, size_t count) {
+  int16_t *out = (int16_t *)dst;
+
+  for (size_t i = 0; i < count; i++) {
+    out[i] = (int16_t)lrintf(clip(src[i] * 32768.f, -32768.f, 32767.f));
+  }
+}
+
+static void toUInt8Scalar(const float *src, void *dst, size_t count) {
+  uint8_t *out = (uint8_t *)dst;
+
+  for (size_t i = 0; i < count; i++) {
+    out[i] = (uint8_t)(lrintf(clip(src[i] * 128.f, -128.f, 127.f)) + 0x80);
+  }
+}
+
+static void firScalar(const float *coef, const float *in, uint32_t taps, uint32_t channel, float *out) {
+  for (uint32_t c = 0; c < channel; c++) {
+    float sum = 0.f;
+
+    for (uint32_t j = 0; j < taps; j++) {
+      sum += coef[j] * in[j * channel + c];
+    }
+
+    out[c] = sum;
+  }
+}
+
+static void butterflyScalar(float *re0, float *im0, float *re1, float *im1, const float *wr, const float *wi, size_t count) {
+  for (size_t k = 0; k < count; k++) {
+    float tr = re1[k] * wr[k] - im1[k] * wi[k];
+    float ti = re1[k] * wi[k] + im1[k] * wr[k];
+
+    re1[k] = re0[k] - tr;
+    im1[k] = im0[k] - ti;
+    re0[k] += tr;
+    im0[k] += ti;
+  }
+}
+
+void Kernels::bindScalar(KernelTable &table) {
+  table.name = "scalar";
+  table.fromInt32 = fromInt32Scalar;
+  table.quantize = quantizeScalar;
+  table.toInt32 = toInt32Scalar;
+  table.toInt24 = toInt24Scalar;
+  table.toInt16 = toInt16Scalar;
+  table.toUInt8 = toUInt8Scalar;
+  table.fir = firScalar;
+  table.butterfly = butterflyScalar;
+}
+
+#ifdef DISPATCH_X86
+
+// SSE2, baseline for every x86 build. Tails go through the scalar versions.
+
+static void fromInt32SSE2(const int32_t *src, float *dst, size_t count) {
+  __m128 s = _mm_set1_ps(1.f / SAMPLE_SCALE_32BIT);
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), s));
+  }
+
+  fromInt32Scalar(src + i, dst + i, count - i);
+}
+
+static void quantizeSSE2(const float *src, float *dst, size_t count, float gain, uint32_t bits) {
+  __m128 s = _mm_set1_ps(gain * SAMPLE_SCALE_24BIT);
+  __m128 inv = _mm_set1_ps(1.f / (1u << (bits - 1)));
+  __m128 lo = _mm_set1_ps(-SAMPLE_SCALE_24BIT);
+  __m128 hi = _mm_set1_ps(SAMPLE_SCALE_24BIT - 1.f);
+  __m128i sh = _mm_cvtsi32_si128(24 - bits);
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), s), lo), hi);
+    __m128i q = _mm_sra_epi32(_mm_cvtps_epi32(x), sh);
+
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(q), inv));
+  }
+
+  quantizeScalar(src + i, dst + i, count - i, gain, bits);
+}
+
+static void toInt32SSE2(const float *src, void *dst, size_t count) {
+  int32_t *out = (int32_t *)dst;
+  __m128 s = _mm_set1_ps(SAMPLE_SCALE_32BIT);
+  __m128 lo = _mm_set1_ps(-SAMPLE_SCALE_32BIT);
+  __m128 hi = _mm_set1_ps(SAMPLE_MAX_32BIT);
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), s), lo), hi);
+
+    _mm_storeu_si128((__m128i *)(out + i), _mm_cvtps_epi32(x));
+  }
+
+  toInt32Scalar(src + i, out + i, count - i);
+}
+
+static void toInt24SSE2(const float *src, void *dst, size_t count) {
+  unsigned char *out = (unsigned char *)dst;
+  __m128 s = _mm_set1_ps(SAMPLE_SCALE_24BIT);
+  __m128 lo = _mm_set1_ps(-SAMPLE_SCALE_24BIT);
+  __m128 hi = _mm_set1_ps(SAMPLE_SCALE_24BIT - 1.f);
+  int32_t q[4];
+  size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), s), lo), hi);
+
+    _mm_storeu_si128((__m128i *)q, _mm_cvtps_epi32(x));
+
+    for (int k = 0; k < 4; k++, out += 3) {
+      out[0] = (unsigned char)q[k];
+      out[1] = (unsigned char)(q[k] >> 8);
+      out[2] = (unsigned char)(q[k] >> 16);
+    }
+  }
+
+  toInt24Scalar(src + i, out, count - i);
+}
+
+static void toInt16SSE2(const float *src, void *dst, size_t count) {
+  int16_t *out = (int16_t *)dst;
+  __m128 s = _mm_set1_ps(32768.f);
+  size_t i = 0;
+
+  // packs saturates, so no explicit clip
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), s));
+    __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), s));
+
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+  }
+
+  toInt16Scalar(src + i, out + i, count - i);
+}
+
+static void toUInt8SSE2(const float *src, void *dst, size_t count) {
+  uint8_t *out = (uint8_t *)dst;
+  __m128 s = _mm_set1_ps(128.f);
+  __m128i bias = _mm_set1_epi16(0x80);
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), s));
+    __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), s));
+    __m128i w = _mm_adds_epi16(_mm_packs_epi32(a, b), bias);
+
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(w, w));
+  }
+
+  toUInt8Scalar(src + i, out + i, count - i);
+}
+
+static void firSSE2(const float *coef, const float *in, uint32_t taps, uint32_t channel, float *out) {
+  uint32_t j = 0;
+  float lanes[4];
+
+  if (channel == 1) {
+    __m128 acc = _mm_setzero_ps();
+
+    for (; j + 4 <= taps; j += 4) {
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(coef + j), _mm_loadu_ps(in + j)));
+    }
+
+    _mm_storeu_ps(lanes, acc);
+    out[0] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; j < taps; j++) {
+      out[0] += coef[j] * in[j];
+    }
+  }
+  else if (channel == 2) {
+    // Two frames per register, coefficients duplicated to match L R L R
+    __m128 acc = _mm_setzero_ps();
+
+    for (; j + 4 <= taps; j += 4) {
+      __m128 h = _mm_loadu_ps(coef + j);
+
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_unpacklo_ps(h, h), _mm_loadu_ps(in + j * 2)));
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_unpackhi_ps(h, h), _mm_loadu_ps(in + j * 2 + 4)));
+    }
+
+    _mm_storeu_ps(lanes, acc);
+    out[0] = lanes[0] + lanes[2];
+    out[1] = lanes[1] + lanes[3];
+
+    for (; j < taps; j++) {
+      out[0] += coef[j] * in[j * 2];
+      out[1] += coef[j] * in[j * 2 + 1];
+    }
+  }
+  else {
+    firScalar(coef, in, taps, channel, out);
+  }
+}
+
+static void butterflySSE2(float *re0, float *im0, float *re1, float *im1, const float *wr, const float *wi, size_t count) {
+  size_t k = 0;
+
+  for (; k + 4 <= count; k += 4) {
+    __m128 ar = _mm_loadu_ps(re0 + k);
+    __m128 ai = _mm_loadu_ps(im0 + k);
+    __m128 br = _mm_loadu_ps(re1 + k);
+    __m128 bi = _mm_loadu_ps(im1 + k);
+    __m128 cr = _mm_loadu_ps(wr + k);
+    __m128 ci = _mm_loadu_ps(wi + k);
+    __m128 tr = _mm_sub_ps(_mm_mul_ps(br, cr), _mm_mul_ps(bi, ci));
+    __m128 ti = _mm_add_ps(_mm_mul_ps(br, ci), _mm_mul_ps(bi, cr));
+
+    _mm_storeu_ps(re1 + k, _mm_sub_ps(ar, tr));
+    _mm_storeu_ps(im1 + k, _mm_sub_ps(ai, ti));
+    _mm_storeu_ps(re0 + k, _mm_add_ps(ar, tr));
+    _mm_storeu_ps(im0 + k, _mm_add_ps(ai, ti));
+  }
+
+  butterflyScalar(re0 + k, im0 + k, re1 + k, im1 + k, wr + k, wi + k, count - k);
+}
+
+void Kernels::bindSSE2(KernelTable &table) {
+  table.name = "SSE2";
+  table.fromInt32 = fromInt32SSE2;
+  table.quantize = quantizeSSE2;
+  table.toInt32 = toInt32SSE2;
+  table.toInt24 = toInt24SSE2;
+  table.toInt16 = toInt16SSE2;
+  table.toUInt8 = toUInt8SSE2;
+  table.fir = firSSE2;
+  table.butterfly = butterflySSE2;
+}
+
+#else
+
+void Kernels::bindSSE2(KernelTable &table) {
+  bindScalar(table);
+}
+
+#endif
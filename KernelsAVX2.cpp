@@ -0,0 +1,256 @@
+#include "Dispatch.h"
+#include "Convert.h"
+
+#include <string.h>
+
+#ifdef DISPATCH_X86
+
+#include <immintrin.h>
+
+// Built without -mavx2 so the binary still starts on SSE2-only machines,
+// only these functions are compiled for AVX2 and they are only bound when
+// the CPU (and OS) support it.
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define KERNEL_AVX2
+#endif
+
+KERNEL_AVX2 static void fromInt32AVX2(const int32_t *src, float *dst, size_t count) {
+  __m256 s = _mm256_set1_ps(1.f / SAMPLE_SCALE_32BIT);
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), s));
+  }
+
+  for (; i < count; i++) {
+    dst[i] = src[i] * (1.f / SAMPLE_SCALE_32BIT);
+  }
+}
+
+KERNEL_AVX2 static void quantizeAVX2(const float *src, float *dst, size_t count, float gain, uint32_t bits) {
+  __m256 s = _mm256_set1_ps(gain * SAMPLE_SCALE_24BIT);
+  __m256 inv = _mm256_set1_ps(1.f / (1u << (bits - 1)));
+  __m256 lo = _mm256_set1_ps(-SAMPLE_SCALE_24BIT);
+  __m256 hi = _mm256_set1_ps(SAMPLE_SCALE_24BIT - 1.f);
+  __m128i sh = _mm_cvtsi32_si128(24 - bits);
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), s), lo), hi);
+    __m256i q = _mm256_sra_epi32(_mm256_cvtps_epi32(x), sh);
+
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(q), inv));
+  }
+
+  // Tail, same rounding as the vector body
+  for (; i < count; i++) {
+    __m128 x = _mm_min_ss(_mm_max_ss(_mm_mul_ss(_mm_set_ss(src[i]), _mm256_castps256_ps128(s)), _mm256_castps256_ps128(lo)), _mm256_castps256_ps128(hi));
+
+    dst[i] = (_mm_cvtss_si32(x) >> (24 - bits)) * _mm_cvtss_f32(_mm256_castps256_ps128(inv));
+  }
+}
+
+KERNEL_AVX2 static __m256i convertClipped(const float *src, __m256 scale, __m256 lo, __m256 hi) {
+  return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src), scale), lo), hi));
+}
+
+KERNEL_AVX2 static void toInt32AVX2(const float *src, void *dst, size_t count) {
+  int32_t *out = (int32_t *)dst;
+  __m256 s = _mm256_set1_ps(SAMPLE_SCALE_32BIT);
+  __m256 lo = _mm256_set1_ps(-SAMPLE_SCALE_32BIT);
+  __m256 hi = _mm256_set1_ps(SAMPLE_MAX_32BIT);
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_si256((__m256i *)(out + i), convertClipped(src + i, s, lo, hi));
+  }
+
+  for (; i < count; i++) {
+    float x = src[i] * SAMPLE_SCALE_32BIT;
+
+    out[i] = _mm_cvtss_si32(_mm_set_ss(x < -SAMPLE_SCALE_32BIT ? -SAMPLE_SCALE_32BIT : (x > SAMPLE_MAX_32BIT ? SAMPLE_MAX_32BIT : x)));
+  }
+}
+
+KERNEL_AVX2 static void toInt24AVX2(const float *src, void *dst, size_t count) {
+  unsigned char *out = (unsigned char *)dst;
+  __m256 s = _mm256_set1_ps(SAMPLE_SCALE_24BIT);
+  __m256 lo = _mm256_set1_ps(-SAMPLE_SCALE_24BIT);
+  __m256 hi = _mm256_set1_ps(SAMPLE_SCALE_24BIT - 1.f);
+  // Drop the top byte of each 32bit sample, per 128bit lane
+  __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                  0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  unsigned char packed[32];
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8, out += 24) {
+    _mm256_storeu_si256((__m256i *)packed, _mm256_shuffle_epi8(convertClipped(src + i, s, lo, hi), pack));
+
+    memcpy(out, packed, 12);
+    memcpy(out + 12, packed + 16, 12);
+  }
+
+  for (; i < count; i++, out += 3) {
+    float x = src[i] * SAMPLE_SCALE_24BIT;
+    int32_t q = _mm_cvtss_si32(_mm_set_ss(x < -SAMPLE_SCALE_24BIT ? -SAMPLE_SCALE_24BIT : (x > SAMPLE_SCALE_24BIT - 1.f ? SAMPLE_SCALE_24BIT - 1.f : x)));
+
+    out[0] = (unsigned char)q;
+    out[1] = (unsigned char)(q >> 8);
+    out[2] = (unsigned char)(q >> 16);
+  }
+}
+
+KERNEL_AVX2 static void toInt16AVX2(const float *src, void *dst, size_t count) {
+  int16_t *out = (int16_t *)dst;
+  __m256 s = _mm256_set1_ps(32768.f);
+  size_t i = 0;
+
+  // packs works per 128bit lane, the permute restores sample order
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i), s));
+    __m256i b = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), s));
+
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8));
+  }
+
+  for (; i < count; i++) {
+    float x = src[i] * 32768.f;
+
+    out[i] = (int16_t)_mm_cvtss_si32(_mm_set_ss(x < -32768.f ? -32768.f : (x > 32767.f ? 32767.f : x)));
+  }
+}
+
+KERNEL_AVX2 static void toUInt8AVX2(const float *src, void *dst, size_t count) {
+  uint8_t *out = (uint8_t *)dst;
+  __m256 s = _mm256_set1_ps(128.f);
+  __m256i bias = _mm256_set1_epi16(0x80);
+  size_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i), s));
+    __m256i b = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), s));
+    __m256i w = _mm256_adds_epi16(_mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8), bias);
+    __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi16(w, w), 0x08);
+
+    _mm_storeu_si128((__m128i *)(out + i), _mm256_castsi256_si128(p));
+  }
+
+  for (; i < count; i++) {
+    float x = src[i] * 128.f;
+
+    out[i] = (uint8_t)(_mm_cvtss_si32(_mm_set_ss(x < -128.f ? -128.f : (x > 127.f ? 127.f : x))) + 0x80);
+  }
+}
+
+KERNEL_AVX2 static float horizontalSum(__m256 x) {
+  __m128 v = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+
+  return _mm_cvtss_f32(v);
+}
+
+KERNEL_AVX2 static void firAVX2(const float *coef, const float *in, uint32_t taps, uint32_t channel, float *out) {
+  uint32_t j = 0;
+
+  if (channel == 1) {
+    __m256 acc = _mm256_setzero_ps();
+
+    for (; j + 8 <= taps; j += 8) {
+      acc = _mm256_fmadd_ps(_mm256_loadu_ps(coef + j), _mm256_loadu_ps(in + j), acc);
+    }
+
+    out[0] = horizontalSum(acc);
+
+    for (; j < taps; j++) {
+      out[0] += coef[j] * in[j];
+    }
+  }
+  else if (channel == 2) {
+    // Four frames per register, coefficients duplicated to match L R L R
+    __m256i spread = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    __m256 acc = _mm256_setzero_ps();
+    float lanes[8];
+
+    for (; j + 4 <= taps; j += 4) {
+      __m256 h = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(coef + j)), spread);
+
+      acc = _mm256_fmadd_ps(h, _mm256_loadu_ps(in + j * 2), acc);
+    }
+
+    _mm256_storeu_ps(lanes, acc);
+    out[0] = (lanes[0] + lanes[2]) + (lanes[4] + lanes[6]);
+    out[1] = (lanes[1] + lanes[3]) + (lanes[5] + lanes[7]);
+
+    for (; j < taps; j++) {
+      out[0] += coef[j] * in[j * 2];
+      out[1] += coef[j] * in[j * 2 + 1];
+    }
+  }
+  else {
+    for (uint32_t c = 0; c < channel; c++) {
+      float sum = 0.f;
+
+      for (j = 0; j < taps; j++) {
+        sum += coef[j] * in[j * channel + c];
+      }
+
+      out[c] = sum;
+    }
+  }
+}
+
+KERNEL_AVX2 static void butterflyAVX2(float *re0, float *im0, float *re1, float *im1, const float *wr, const float *wi, size_t count) {
+  size_t k = 0;
+
+  for (; k + 8 <= count; k += 8) {
+    __m256 ar = _mm256_loadu_ps(re0 + k);
+    __m256 ai = _mm256_loadu_ps(im0 + k);
+    __m256 br = _mm256_loadu_ps(re1 + k);
+    __m256 bi = _mm256_loadu_ps(im1 + k);
+    __m256 cr = _mm256_loadu_ps(wr + k);
+    __m256 ci = _mm256_loadu_ps(wi + k);
+    __m256 tr = _mm256_fmsub_ps(br, cr, _mm256_mul_ps(bi, ci));
+    __m256 ti = _mm256_fmadd_ps(br, ci, _mm256_mul_ps(bi, cr));
+
+    _mm256_storeu_ps(re1 + k, _mm256_sub_ps(ar, tr));
+    _mm256_storeu_ps(im1 + k, _mm256_sub_ps(ai, ti));
+    _mm256_storeu_ps(re0 + k, _mm256_add_ps(ar, tr));
+    _mm256_storeu_ps(im0 + k, _mm256_add_ps(ai, ti));
+  }
+
+  for (; k < count; k++) {
+    float tr = re1[k] * wr[k] - im1[k] * wi[k];
+    float ti = re1[k] * wi[k] + im1[k] * wr[k];
+
+    re1[k] = re0[k] - tr;
+    im1[k] = im0[k] - ti;
+    re0[k] += tr;
+    im0[k] += ti;
+  }
+}
+
+void Kernels::bindAVX2(KernelTable &table) {
+  table.name = "AVX2";
+  table.fromInt32 = fromInt32AVX2;
+  table.quantize = quantizeAVX2;
+  table.toInt32 = toInt32AVX2;
+  table.toInt24 = toInt24AVX2;
+  table.toInt16 = toInt16AVX2;
+  table.toUInt8 = toUInt8AVX2;
+  table.fir = firAVX2;
+  table.butterfly = butterflyAVX2;
+}
+
+#else
+
+void Kernels::bindAVX2(KernelTable &table) {
+  bindSSE2(table);
+}
+
+#endif
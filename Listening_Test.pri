@@ -9,11 +9,43 @@ message("You are running qmake on a generated .pro file. This may not work!")
 
 HEADERS += ./Audio.h \
     ./Model.h \
-    ./MainWindow.h
+    ./MainWindow.h \
+    ./Analyzer.h \
+    ./Spectrum.h \
+    ./Loudness.h \
+    ./Buffer.h \
+    ./RealTime.h \
+    ./Convert.h \
+    ./Resampler.h \
+    ./Dispatch.h \
+    ./Backend.h \
+    ./ThreadPool.h \
+    ./Stimulus.h \
+    ./Trace.h \
+    ./Codec.h \
+    ./Feeder.h \
+    ./Hash.h
 SOURCES += ./Audio.cpp \
     ./main.cpp \
     ./MainWindow.cpp \
-    ./Model.cpp
+    ./Model.cpp \
+    ./Analyzer.cpp \
+    ./Spectrum.cpp \
+    ./Loudness.cpp \
+    ./Buffer.cpp \
+    ./RealTime.cpp \
+    ./Convert.cpp \
+    ./Resampler.cpp \
+    ./Dispatch.cpp \
+    ./Kernels.cpp \
+    ./KernelsAVX2.cpp \
+    ./Backend.cpp \
+    ./ThreadPool.cpp \
+    ./Stimulus.cpp \
+    ./Trace.cpp \
+    ./Codec.cpp \
+    ./Feeder.cpp \
+    ./Hash.cpp
 FORMS += ./MainWindow.ui \
     ./Progress.ui
 RESOURCES += MainWindow.qrc
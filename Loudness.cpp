@@ -0,0 +1,285 @@
+#include "Loudness.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LOUDNESS_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+LoudnessMeter::LoudnessMeter() {
+  reset(48000, 2);
+}
+
+void LoudnessMeter::reset(uint32_t _samplingrate, uint32_t _channel_count) {
+  double K, Q, Vh, Vb, a0;
+
+  samplingrate = _samplingrate;
+  channel_count = std::min<uint32_t>(_channel_count, LOUDNESS_MAX_CHANNEL);
+  stride = _channel_count;
+
+  // K-weighting coefficients for arbitrary sampling rates (b0, b1, b2, a1, a2)
+  K = tan(M_PI * 1681.974450955533 / samplingrate);
+  Q = 0.7071752369554196;
+  Vh = pow(10.0, 3.999843853973347 / 20.0);
+  Vb = pow(Vh, 0.4996667741545416);
+  a0 = 1.0 + K / Q + K * K;
+
+  coef_shelf[0] = (Vh + Vb * K / Q + K * K) / a0;
+  coef_shelf[1] = 2.0 * (K * K - Vh) / a0;
+  coef_shelf[2] = (Vh - Vb * K / Q + K * K) / a0;
+  coef_shelf[3] = 2.0 * (K * K - 1.0) / a0;
+  coef_shelf[4] = (1.0 - K / Q + K * K) / a0;
+
+  K = tan(M_PI * 38.13547087602444 / samplingrate);
+  Q = 0.5003270373238773;
+  a0 = 1.0 + K / Q + K * K;
+
+  coef_highpass[0] = 1.0;
+  coef_highpass[1] = -2.0;
+  coef_highpass[2] = 1.0;
+  coef_highpass[3] = 2.0 * (K * K - 1.0) / a0;
+  coef_highpass[4] = (1.0 - K / Q + K * K) / a0;
+
+  // Channel weights, surround channels of 5.1 get +1.5dB and LFE is excluded
+  for (uint32_t c = 0; c < LOUDNESS_MAX_CHANNEL; c++) {
+    weight[c] = 1.0;
+  }
+  if (channel_count == 6) {
+    weight[3] = 0.0;
+    weight[4] = 1.41;
+    weight[5] = 1.41;
+  }
+
+  memset(state, 0, sizeof(state));
+  memset(subblock_energy, 0, sizeof(subblock_energy));
+  subblock_frames = std::max<uint32_t>(samplingrate / 10, 1);
+  subblock_pos = 0;
+  subblocks.clear();
+
+  // True-peak needs at least 192kHz effective rate
+  oversample = samplingrate < 96000 ? 4 : (samplingrate < 192000 ? 2 : 1);
+  interp.resize(oversample * TRUEPEAK_TAPS);
+
+  for (uint32_t n = 0; n < interp.size(); n++) {
+    double x = ((double)n - (interp.size() - 1) / 2.0) / oversample;
+    double w = 0.5 + 0.5 * cos(2.0 * M_PI * ((double)n - (interp.size() - 1) / 2.0) / interp.size());
+
+    interp[n] = (float)((x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x)) * w);
+  }
+
+  history.assign(channel_count * TRUEPEAK_TAPS * 2, 0.f);
+  history_pos = 0;
+  peak = 0.f;
+}
+
+void LoudnessMeter::filter(const float *data, uint32_t frames) {
+  const double *s = coef_shelf;
+  const double *h = coef_highpass;
+
+  for (uint32_t c = 0; c < channel_count; c++) {
+    double *z = state[c];
+    double energy = 0.0;
+
+    for (uint32_t i = 0; i < frames; i++) {
+      double x = data[i * stride + c];
+      double y = s[0] * x + z[0];
+
+      z[0] = s[1] * x - s[3] * y + z[1];
+      z[1] = s[2] * x - s[4] * y;
+
+      x = y;
+      y = h[0] * x + z[2];
+      z[2] = h[1] * x - h[3] * y + z[3];
+      z[3] = h[2] * x - h[4] * y;
+
+      energy += y * y;
+    }
+
+    subblock_energy[c] += energy;
+  }
+}
+
+void LoudnessMeter::filterSSE2(const float *data, uint32_t frames) {
+#ifdef LOUDNESS_SSE2
+  // Two channels per register, the recursion runs along time so lanes are channels
+  uint32_t pairs = channel_count / 2;
+
+  __m128d s0 = _mm_set1_pd(coef_shelf[0]), s1 = _mm_set1_pd(coef_shelf[1]), s2 = _mm_set1_pd(coef_shelf[2]);
+  __m128d s3 = _mm_set1_pd(coef_shelf[3]), s4 = _mm_set1_pd(coef_shelf[4]);
+  __m128d h0 = _mm_set1_pd(coef_highpass[0]), h1 = _mm_set1_pd(coef_highpass[1]), h2 = _mm_set1_pd(coef_highpass[2]);
+  __m128d h3 = _mm_set1_pd(coef_highpass[3]), h4 = _mm_set1_pd(coef_highpass[4]);
+
+  for (uint32_t p = 0; p < pairs; p++) {
+    uint32_t c = p * 2;
+    __m128d z0 = _mm_set_pd(state[c + 1][0], state[c][0]);
+    __m128d z1 = _mm_set_pd(state[c + 1][1], state[c][1]);
+    __m128d z2 = _mm_set_pd(state[c + 1][2], state[c][2]);
+    __m128d z3 = _mm_set_pd(state[c + 1][3], state[c][3]);
+    __m128d energy = _mm_setzero_pd();
+
+    for (uint32_t i = 0; i < frames; i++) {
+      const float *in = data + i * stride + c;
+      __m128d x = _mm_set_pd(in[1], in[0]);
+      __m128d y = _mm_add_pd(_mm_mul_pd(s0, x), z0);
+
+      z0 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(s1, x), _mm_mul_pd(s3, y)), z1);
+      z1 = _mm_sub_pd(_mm_mul_pd(s2, x), _mm_mul_pd(s4, y));
+
+      x = y;
+      y = _mm_add_pd(_mm_mul_pd(h0, x), z2);
+      z2 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(h1, x), _mm_mul_pd(h3, y)), z3);
+      z3 = _mm_sub_pd(_mm_mul_pd(h2, x), _mm_mul_pd(h4, y));
+
+      energy = _mm_add_pd(energy, _mm_mul_pd(y, y));
+    }
+
+    double out[2];
+
+    _mm_storel_pd(&state[c][0], z0); _mm_storeh_pd(&state[c + 1][0], z0);
+    _mm_storel_pd(&state[c][1], z1); _mm_storeh_pd(&state[c + 1][1], z1);
+    _mm_storel_pd(&state[c][2], z2); _mm_storeh_pd(&state[c + 1][2], z2);
+    _mm_storel_pd(&state[c][3], z3); _mm_storeh_pd(&state[c + 1][3], z3);
+    _mm_storeu_pd(out, energy);
+
+    subblock_energy[c] += out[0];
+    subblock_energy[c + 1] += out[1];
+  }
+
+  // Odd channel left over
+  if (channel_count % 2) {
+    uint32_t c = channel_count - 1;
+    double *z = state[c];
+    double energy = 0.0;
+
+    for (uint32_t i = 0; i < frames; i++) {
+      double x = data[i * stride + c];
+      double y = coef_shelf[0] * x + z[0];
+
+      z[0] = coef_shelf[1] * x - coef_shelf[3] * y + z[1];
+      z[1] = coef_shelf[2] * x - coef_shelf[4] * y;
+
+      x = y;
+      y = coef_highpass[0] * x + z[2];
+      z[2] = coef_highpass[1] * x - coef_highpass[3] * y + z[3];
+      z[3] = coef_highpass[2] * x - coef_highpass[4] * y;
+
+      energy += y * y;
+    }
+
+    subblock_energy[c] += energy;
+  }
+#else
+  filter(data, frames);
+#endif
+}
+
+void LoudnessMeter::measurePeak(const float *data, uint32_t frames) {
+  if (oversample == 1) {
+    for (uint32_t i = 0; i < frames; i++) {
+      for (uint32_t c = 0; c < channel_count; c++) {
+        peak = std::max(peak, fabsf(data[i * stride + c]));
+      }
+    }
+
+    return;
+  }
+
+  for (uint32_t i = 0; i < frames; i++) {
+    for (uint32_t c = 0; c < channel_count; c++) {
+      float *hist = history.data() + c * TRUEPEAK_TAPS * 2;
+      float x = data[i * stride + c];
+
+      hist[history_pos] = x;
+      hist[history_pos + TRUEPEAK_TAPS] = x;
+
+      // Newest sample at hist[history_pos + TRUEPEAK_TAPS]
+      const float *newest = hist + history_pos + TRUEPEAK_TAPS;
+
+      for (uint32_t p = 0; p < oversample; p++) {
+        float y = 0.f;
+
+        for (uint32_t t = 0; t < TRUEPEAK_TAPS; t++) {
+          y += interp[p + oversample * t] * newest[-(int)t];
+        }
+
+        peak = std::max(peak, fabsf(y));
+      }
+    }
+
+    history_pos = (history_pos + 1) % TRUEPEAK_TAPS;
+  }
+}
+
+void LoudnessMeter::process(const float *data, uint32_t frames) {
+  measurePeak(data, frames);
+
+  while (frames > 0) {
+    uint32_t count = std::min(frames, subblock_frames - subblock_pos);
+
+    filterSSE2(data, count);
+
+    data += count * stride;
+    frames -= count;
+    subblock_pos += count;
+
+    if (subblock_pos == subblock_frames) {
+      double sum = 0.0;
+
+      for (uint32_t c = 0; c < channel_count; c++) {
+        sum += weight[c] * subblock_energy[c];
+        subblock_energy[c] = 0.0;
+      }
+
+      subblocks.push_back(sum);
+      subblock_pos = 0;
+    }
+  }
+}
+
+double LoudnessMeter::getIntegrated() {
+  std::vector<double> blocks;
+  double sum = 0.0;
+  double relative_gate;
+  uint32_t count = 0;
+
+  // 400ms gating blocks with 75% overlap
+  for (size_t i = 0; i + 3 < subblocks.size(); i++) {
+    double energy = (subblocks[i] + subblocks[i + 1] + subblocks[i + 2] + subblocks[i + 3]) / (4.0 * subblock_frames);
+
+    if (-0.691 + 10.0 * log10(energy + 1e-30) > LOUDNESS_ABSOLUTE_GATE) {
+      blocks.push_back(energy);
+      sum += energy;
+    }
+  }
+
+  if (blocks.empty()) {
+    return LOUDNESS_SILENCE;
+  }
+
+  relative_gate = -0.691 + 10.0 * log10(sum / blocks.size()) + LOUDNESS_RELATIVE_GATE;
+  sum = 0.0;
+
+  for (auto energy : blocks) {
+    if (-0.691 + 10.0 * log10(energy) > relative_gate) {
+      sum += energy;
+      count++;
+    }
+  }
+
+  if (count == 0) {
+    return LOUDNESS_SILENCE;
+  }
+
+  return -0.691 + 10.0 * log10(sum / count);
+}
+
+double LoudnessMeter::getTruePeak() {
+  return 20.0 * log10(peak + 1e-30);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#ifndef _LOUDNESS_H_
+#define _LOUDNESS_H_
+
+#include <vector>
+#include <stdint.h>
+
+#define LOUDNESS_ABSOLUTE_GATE    -70.0
+#define LOUDNESS_RELATIVE_GATE    -10.0
+#define LOUDNESS_MATCH_TOLERANCE  0.1
+#define LOUDNESS_SILENCE          -200.0
+
+#define TRUEPEAK_TAPS             12    // taps per polyphase branch
+#define LOUDNESS_MAX_CHANNEL      8
+
+// ITU-R BS.1770 integrated loudness and true-peak meter.
+// Samples are fed incrementally so the measurement can ride along with
+// whatever loop already touches the audio.
+class LoudnessMeter {
+  private:
+    uint32_t samplingrate;
+    uint32_t channel_count;               // metered, the first ones of each frame
+    uint32_t stride;                      // channels per interleaved input frame
+
+    // K-weighting, pre-filter (high shelf) followed by RLB high-pass
+    double coef_shelf[5];
+    double coef_highpass[5];
+    double state[LOUDNESS_MAX_CHANNEL][4];
+    double weight[LOUDNESS_MAX_CHANNEL];
+
+    // 100ms sub-block energies, gating blocks are 4 consecutive sub-blocks
+    uint32_t subblock_frames;
+    uint32_t subblock_pos;
+    double subblock_energy[LOUDNESS_MAX_CHANNEL];
+    std::vector<double> subblocks;
+
+    // True-peak by polyphase oversampling
+    uint32_t oversample;
+    std::vector<float> interp;
+    std::vector<float> history;
+    uint32_t history_pos;
+    float peak;
+
+    void filter(const float *, uint32_t);
+    void filterSSE2(const float *, uint32_t);
+    void measurePeak(const float *, uint32_t);
+
+  public:
+    LoudnessMeter();
+
+    void reset(uint32_t, uint32_t);
+    void process(const float *, uint32_t);
+
+    double getIntegrated();
+    double getTruePeak();
+};
+
+#endif
@@ -1,17 +1,49 @@
 #include "MainWindow.h"
 
-MainWindow::MainWindow(QWidget *parent)
+static void formatTime(uint32_t ms, char *buffer, size_t length) {
+  uint32_t hour = ms / 1000 / 60 / 60;
+  uint32_t min = ms / 1000 / 60 % 60;
+  uint32_t sec = ms / 1000 % 60;
+
+  snprintf(buffer, length, "%u:%02u:%02u", hour, min, sec);
+}
+
+MainWindow::MainWindow(AudioSystem &_audio, int _station, int station_count, QWidget *parent)
   : QMainWindow(parent),
     songModel(parent),
-    resultModel(parent) {
+    songView(&songModel, parent),
+    resultModel(parent),
+    audio(_audio) {
   // Initialization
   ui.setupUi(this);
   session = NULL;
+  spectrum = NULL;
+  progress = NULL;
+  station = _station;
+  song_row = -1;
+
+  // Show which DSP kernels this station runs, results are compared across machines
+  setWindowTitle(windowTitle() + " [" + QString::fromStdString(Dispatch::getReport()) + "]");
 
-  // Assign model for file list
-  ui.fileTableView->setModel(&songModel);
+  if (station_count > 1) {
+    setWindowTitle(windowTitle() + STRING_UI_STATION + QString::number(station + 1));
+  }
+
+  // Devices are filled in by the timer once the backend is up, songs
+  // already prepared meanwhile play on the default device
+  output_device = paNoDevice;
+  bAudioReady = false;
+
+  // Assign model for file list, the view shows the filtered and sorted rows
+  ui.fileTableView->setModel(&songView);
   ui.fileTableView->setColumnWidth(0, 480);
   ui.fileTableView->setColumnWidth(1, 120);
+  ui.fileTableView->setColumnWidth(2, 120);
+  ui.fileTableView->setColumnWidth(3, 80);
+  ui.fileTableView->setColumnWidth(4, 80);
+  ui.fileTableView->setColumnWidth(5, 80);
+  ui.fileTableView->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+  ui.fileTableView->setSortingEnabled(true);
 
   // Assign model for result list
   ui.resultTableView->setModel(&resultModel);
@@ -21,42 +53,42 @@ MainWindow::MainWindow(QWidget *parent)
   ui.resultTableView->setColumnWidth(3, 80);
   ui.resultTableView->setColumnWidth(4, 80);
   ui.resultTableView->setColumnWidth(5, 200);
+  ui.resultTableView->setColumnWidth(6, 220);
+  ui.resultTableView->setColumnWidth(7, 480);
+  ui.resultTableView->setColumnWidth(8, 600);
+  ui.resultTableView->setColumnWidth(9, 220);
+  ui.resultTableView->setColumnWidth(10, 120);
 
   // Connect handler
   connect(&timer, &QTimer::timeout, [&]() {
+    if (!bAudioReady && audio.isReady()) {
+      setupDevices();
+    }
+
     if (session) {
       if (session->isPlaying()) {
         uint32_t cur, max;
-        std::function<std::string(uint32_t)> convert = [](uint32_t ms) {
-          char temp[16];
-          uint32_t hour;
-          uint8_t min;
-          uint8_t sec;
 
-          hour = ms / 1000 / 60 / 60;
-          min = ms / 1000 / 60 % 60;
-          sec = ms / 1000 % 60;
-
-#ifdef WIN32
-          sprintf_s(temp, "%d:%02d:%02d", hour, min, sec);
-#else
-          sprintf(temp, "%d:%02d:%02d", hour, min, sec);
-#endif
+        session->getTimeInfo(cur, max);
 
-          return std::string(temp);
-        };
+        // Only the user moves the slider to seek, progress updates must not
+        if (!ui.timeSlider->isSliderDown()) {
+          QSignalBlocker blocker(ui.timeSlider);
 
-        session->getTimeInfo(cur, max);
-        ui.timeSlider->setRange(0, max);
-        ui.timeSlider->setValue(cur);
+          ui.timeSlider->setRange(0, max);
+          ui.timeSlider->setValue(cur);
+        }
 
-        std::string str;
+        char str[40];
 
-        str.append(convert(cur));
-        str.append(" / ");
-        str.append(convert(max));
+        formatTime(cur, str, 20);
+        strcat(str, " / ");
+        formatTime(max, str + strlen(str), 20);
 
-        ui.timeLabel->setText(str.c_str());
+        // Label only changes once a second, skip relayout otherwise
+        if (ui.timeLabel->text() != str) {
+          ui.timeLabel->setText(str);
+        }
       }
     }
   });
@@ -67,10 +99,11 @@ MainWindow::MainWindow(QWidget *parent)
       for (auto path : pathlist) {
         uint32_t samplerate;
         uint8_t bitdepth;
+        uint32_t duration;
         std::string stdpath = path.toStdString();
         
-        if (audio.getInfo(stdpath, samplerate, bitdepth)) {
-          Song song(path, samplerate, bitdepth);
+        if (audio.getInfo(stdpath, samplerate, bitdepth, duration)) {
+          Song song(path, samplerate, bitdepth, duration);
           
           songModel.appendSong(song);
         }
@@ -83,37 +116,80 @@ MainWindow::MainWindow(QWidget *parent)
     if (select->hasSelection()) {
       QModelIndexList list = select->selectedRows();
 
-      SAFE_DELETE(session);
+      audio.releaseSession(session);
+      session = NULL;
+
+      songModel.removeSong(songView.mapToSource(list.at(0).row()));
+      song_row = -1;
 
-      songModel.removeSong(list.at(0).row());
+      ui.timeSlider->setEnabled(false);
+      ui.testConfirmButton->setEnabled(false);
+      ui.playButton_1->setEnabled(false);
+      ui.stopButton_1->setEnabled(false);
+      ui.selectSongButton_1->setEnabled(false);
+      ui.playButton_2->setEnabled(false);
+      ui.stopButton_2->setEnabled(false);
+      ui.selectSongButton_2->setEnabled(false);
+      ui.testTypeCombo->setEnabled(false);
+      ui.hqAudioCombo->setEnabled(false);
+      ui.lqAudioCombo->setEnabled(false);
+      ui.currentFileLabel->setText(STRING_UI_FILE_NOT_SELECTED);
     }
   });
   connect(ui.testConfirmButton, &QPushButton::clicked, [&]() {
     if (session) {
-      ProgressDialog progress;
-      
-      if (session->setTestInfo(ui.hqAudioCombo->currentText().toStdString(), ui.lqAudioCombo->currentText().toStdString())) {
-        progress.show();
+      std::string hqFactor = ui.hqAudioCombo->currentText().toStdString();
+      std::string lqFactor = ui.lqAudioCombo->currentText().toStdString();
+      bool testtype = ui.testTypeCombo->currentText().compare(STRING_LIST_SAMPLINGRATE) == 0;
 
-        session->readSound();
+      // Settled conditions aren't prepared again, checked before the session
+      // takes the new excerpt or factors
+      if (resultModel.getDecision(testtype ? Result::TEST_SAMPLINGRATE : Result::TEST_BITDEPTH, atol(hqFactor.c_str()), atol(lqFactor.c_str())) != SequentialTest::DECISION_OPEN) {
+        QMessageBox::information(this, STRING_UI_SEQUENTIAL, STRING_UI_DECIDED);
 
-        progress.close();
+        return;
+      }
+
+      // Excerpt may have been edited after the song was selected
+      if (song_row >= 0) {
+        const Song &song = songModel.getItem(song_row);
+
+        session->setExcerpt(song.getExcerptStart(), song.getExcerptEnd());
+      }
+      
+      if (session->setTestInfo(hqFactor, lqFactor)) {
+        SongSession *target = session;
+
+        // Prepared on a worker and finished from the queued signal, so the
+        // other stations keep running and none waits for another's decode.
+        // The dialog only blocks this window.
+        progress = new ProgressDialog(this);
+        progress->setWindowModality(Qt::WindowModal);
+        progress->show();
 
-        ui.playButton_1->setEnabled(true);
-        ui.playButton_2->setEnabled(true);
-        ui.selectSongButton_1->setEnabled(true);
-        ui.selectSongButton_2->setEnabled(true);
         ui.testConfirmButton->setEnabled(false);
-        ui.testTypeCombo->setEnabled(false);
-        ui.hqAudioCombo->setEnabled(false);
-        ui.lqAudioCombo->setEnabled(false);
+
+        preparer = std::thread([this, target]() {
+          emit prepared(target->readSound());
+        });
       }
     }
   });
+  connect(this, &MainWindow::prepared, this, [&](bool bDecoded) {
+    finishPrepare(bDecoded);
+  }, Qt::QueuedConnection);
   connect(ui.playButton_1, &QPushButton::clicked, [&]() {
     if (session) {
       if (!session->isInited()) {
+        if (!checkDevice()) {
+          return;
+        }
+
+        session->setOutputDevice(output_device);
+
         if (session->startPlaying(true)) {
+          reportPlayback();
+
           ui.currentFileLabel->setText(STRING_UI_PLAYING_FIRST);
 
           ui.playButton_2->setEnabled(false);
@@ -130,6 +206,7 @@ MainWindow::MainWindow(QWidget *parent)
       ui.currentFileLabel->setText(STRING_UI_FILE_NOT_SELECTED);
 
       session->stopPlaying();
+      reportPlayback();
 
       ui.playButton_2->setEnabled(true);
       ui.stopButton_1->setEnabled(false);
@@ -145,13 +222,31 @@ MainWindow::MainWindow(QWidget *parent)
       session->getTestResult(answer);
       session->getTestInfo(testtype, factorH, factorL);
       
-      QString filename = songModel.getItem(ui.fileTableView->selectionModel()->selectedRows().at(0).row()).getData(0);
+      QString filename = songModel.getItem(song_row).getData(0);
       QString empty;
       Result item(filename, testtype ? Result::TEST_SAMPLINGRATE : Result::TEST_BITDEPTH, answer, true, factorH, factorL, empty);
 
-      resultModel.appendResult(item);
+      double lufsH, lufsL, peakH, peakL;
+
+      session->getLoudnessInfo(lufsH, lufsL, peakH, peakL);
+      item.setLoudness(lufsH, lufsL, peakH, peakL);
+
+      PlaybackIntegrity integrity;
+
+      session->getIntegrityInfo(integrity);
+      item.setIntegrity(integrity);
+
+      uint32_t start, end;
+
+      session->getExcerpt(start, end);
+      item.setExcerpt(start, end);
+
+      if (resultModel.appendResult(item)) {
+        QMessageBox::information(this, STRING_UI_SEQUENTIAL, STRING_UI_SETTLED);
+      }
 
       session->stopPlaying();
+      reportPlayback();
       
       ui.timeSlider->setEnabled(false);
       ui.testConfirmButton->setEnabled(false);
@@ -169,7 +264,15 @@ MainWindow::MainWindow(QWidget *parent)
   connect(ui.playButton_2, &QPushButton::clicked, [&]() {
     if (session) {
       if (!session->isInited()) {
+        if (!checkDevice()) {
+          return;
+        }
+
+        session->setOutputDevice(output_device);
+
         if (session->startPlaying(false)) {
+          reportPlayback();
+
           ui.currentFileLabel->setText(STRING_UI_PLAYING_SECOND);
 
           ui.playButton_1->setEnabled(false);
@@ -186,6 +289,7 @@ MainWindow::MainWindow(QWidget *parent)
       ui.currentFileLabel->setText(STRING_UI_FILE_NOT_SELECTED);
 
       session->stopPlaying();
+      reportPlayback();
 
       ui.playButton_1->setEnabled(true);
       ui.stopButton_2->setEnabled(false);
@@ -201,12 +305,31 @@ MainWindow::MainWindow(QWidget *parent)
       session->getTestResult(answer);
       session->getTestInfo(testtype, factorH, factorL);
       
-      QString filename = songModel.getItem(ui.fileTableView->selectionModel()->selectedRows().at(0).row()).getData(0);
+      QString filename = songModel.getItem(song_row).getData(0);
       QString empty;
       Result item(filename, testtype ? Result::TEST_SAMPLINGRATE : Result::TEST_BITDEPTH, answer, false, factorH, factorL, empty);
-      resultModel.appendResult(item);
+
+      double lufsH, lufsL, peakH, peakL;
+
+      session->getLoudnessInfo(lufsH, lufsL, peakH, peakL);
+      item.setLoudness(lufsH, lufsL, peakH, peakL);
+
+      PlaybackIntegrity integrity;
+
+      session->getIntegrityInfo(integrity);
+      item.setIntegrity(integrity);
+
+      uint32_t start, end;
+
+      session->getExcerpt(start, end);
+      item.setExcerpt(start, end);
+
+      if (resultModel.appendResult(item)) {
+        QMessageBox::information(this, STRING_UI_SEQUENTIAL, STRING_UI_SETTLED);
+      }
 
       session->stopPlaying();
+      reportPlayback();
 
       ui.timeSlider->setEnabled(false);
       ui.testConfirmButton->setEnabled(false);
@@ -232,32 +355,31 @@ MainWindow::MainWindow(QWidget *parent)
   connect(ui.resetResultButton, &QPushButton::clicked, [&]() {
     resultModel.resetList();
   });
+  connect(ui.searchEdit, &QLineEdit::textChanged, [&](const QString &text) {
+    songView.setFilter(SongFilter::parse(text));
+  });
   connect(ui.fileTableView->selectionModel(), &QItemSelectionModel::selectionChanged, [&](const QItemSelection &selected, const QItemSelection &deselected) {
     Q_UNUSED(deselected);
     
+    // Filtering can drop the song under test from the view, the trial
+    // controls follow the session and not the selection
     if (selected.count() == 0) {
       ui.deleteFileButton->setEnabled(false);
-      ui.testConfirmButton->setEnabled(false);
-      ui.playButton_1->setEnabled(false);
-      ui.stopButton_1->setEnabled(false);
-      ui.selectSongButton_1->setEnabled(false);
-      ui.playButton_2->setEnabled(false);
-      ui.stopButton_2->setEnabled(false);
-      ui.selectSongButton_2->setEnabled(false);
-      ui.testTypeCombo->setEnabled(false);
-      ui.hqAudioCombo->setEnabled(false);
-      ui.lqAudioCombo->setEnabled(false);
     }
     else {
       ui.deleteFileButton->setEnabled(true);
       ui.testConfirmButton->setEnabled(false);
 
-      SAFE_DELETE(session);
+      // Free the previous song in the background
+      audio.releaseSession(session);
+      session = NULL;
 
-      int rowidx = selected.at(0).indexes().at(0).row();
+      // Kept as a source row, filtering or sorting the view moves the selection
+      song_row = songView.mapToSource(selected.at(0).indexes().at(0).row());
 
-      session = new SongSession(&audio);
-      session->openSound(songModel.getItem(rowidx).getPath().toStdString().c_str());
+      session = new SongSession(&audio, &tap, output_device);
+      session->setRealtimeMode(ui.realtimeCheckBox->isChecked());
+      session->openSound(songModel.getItem(song_row).getPath().toStdString().c_str());
 
       ui.testTypeCombo->clear();
       ui.testTypeCombo->setEnabled(true);
@@ -276,17 +398,50 @@ MainWindow::MainWindow(QWidget *parent)
     }
   });
   connect(ui.sineWaveButton, &QPushButton::clicked, [&]() {
-    if (!session) {
+    if (!session && checkDevice()) {
       int freq = 0;
 
-      session = new SongSession(&audio);
+      session = new SongSession(&audio, &tap, output_device);
 
       freq = ui.freqInputBox->value();
 
       session->sineWaveTest(freq);
 
-      SAFE_DELETE(session);
+      audio.releaseSession(session);
+      session = NULL;
+    }
+  });
+  connect(ui.realtimeCheckBox, &QCheckBox::toggled, [&](bool checked) {
+    if (session) {
+      session->setRealtimeMode(checked);
+    }
+  });
+  connect(ui.deviceCombo, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), [&](int index) {
+    // Used from the next playback on, a running session keeps its stream
+    if (index >= 0 && index < (int)devices.size()) {
+      output_device = devices[index].index;
+    }
+  });
+  // Writes what was recorded so far, recording goes on
+  if (Trace::isEnabled()) {
+    connect(new QShortcut(QKeySequence(TRACE_SHORTCUT), this), &QShortcut::activated, [&]() {
+      QString path = QString::fromStdString(Trace::getPath());
+
+      if (Trace::dump(Trace::getPath())) {
+        QMessageBox::information(this, STRING_UI_TRACE, path);
+      }
+      else {
+        QMessageBox::warning(this, STRING_UI_TRACE, path);
+      }
+    });
+  }
+  connect(ui.spectrumButton, &QPushButton::clicked, [&]() {
+    if (!spectrum) {
+      spectrum = new SpectrumWindow(&tap);
     }
+
+    spectrum->show();
+    spectrum->raise();
   });
 
   std::function<void(const QString &)> fctComboHandler = [&](const QString &index) {
@@ -333,7 +488,7 @@ MainWindow::MainWindow(QWidget *parent)
   connect(ui.lqAudioCombo, &QComboBox::currentTextChanged, fctComboHandler);
   
   // Begin timer
-  timer.start(1000);
+  timer.start(PLAYHEAD_INTERVAL_MS);
 
   // Disable buttons
   ui.deleteFileButton->setEnabled(false);
@@ -348,13 +503,118 @@ MainWindow::MainWindow(QWidget *parent)
   ui.testTypeCombo->setEnabled(false);
   ui.hqAudioCombo->setEnabled(false);
   ui.lqAudioCombo->setEnabled(false);
+  ui.deviceCombo->setEnabled(false);
+  ui.sineWaveButton->setEnabled(false);
 
   // Set label
   ui.currentFileLabel->setText(STRING_UI_FILE_NOT_SELECTED);
 }
 
 MainWindow::~MainWindow() {
-  SAFE_DELETE(session);
+  SAFE_DELETE(spectrum);
+
+  // The session must outlive a decode still running
+  if (preparer.joinable()) {
+    preparer.join();
+  }
+
+  audio.releaseSession(session);
+  session = NULL;
+}
+
+void MainWindow::setupDevices() {
+  // Station 0 takes the system default, the others take the remaining
+  // outputs in order, skipping the default so no two stations share it.
+  // A station left without one plays nothing until the operator picks one.
+  PaDeviceIndex preferred = station > 0 ? paNoDevice : audio.getDefaultDevice();
+  int order = 0;
+
+  bAudioReady = true;
+  audio.getOutputDevices(devices);
+
+  for (auto &device : devices) {
+    if (station > 0 && device.index != audio.getDefaultDevice() && ++order == station) {
+      preferred = device.index;
+    }
+  }
+
+  output_device = preferred;
+
+  {
+    QSignalBlocker blocker(ui.deviceCombo);
+
+    for (auto &device : devices) {
+      ui.deviceCombo->addItem(QString::fromStdString(device.name));
+
+      if (device.index == preferred) {
+        ui.deviceCombo->setCurrentIndex(ui.deviceCombo->count() - 1);
+      }
+    }
+
+    if (preferred == paNoDevice) {
+      ui.deviceCombo->setCurrentIndex(-1);
+    }
+  }
+
+  ui.deviceCombo->setEnabled(true);
+  ui.sineWaveButton->setEnabled(true);
+
+  checkDevice();
+}
+
+bool MainWindow::checkDevice() {
+  if (station > 0 && output_device == paNoDevice) {
+    QMessageBox::warning(this, STRING_UI_DEVICE, STRING_UI_NO_DEVICE);
+
+    return false;
+  }
+
+  return true;
+}
+
+void MainWindow::finishPrepare(bool bDecoded) {
+  // Play buttons come up only once there is something to play on
+  if (bDecoded && !audio.isReady()) {
+    QTimer::singleShot(PREPARE_POLL_MS, this, [this, bDecoded]() { finishPrepare(bDecoded); });
+
+    return;
+  }
+
+  preparer.join();
+
+  progress->close();
+  SAFE_DELETE(progress);
+
+  // A stimulus cut short by a decode error is never played
+  if (!bDecoded) {
+    QMessageBox::warning(this, STRING_UI_READ_SONG, STRING_UI_DECODE_FAILED);
+    ui.testConfirmButton->setEnabled(true);
+
+    return;
+  }
+
+  std::string report;
+
+  if (session->getDecodeReport(report)) {
+    QMessageBox::information(this, STRING_UI_READ_SONG, QString::fromStdString(report));
+  }
+
+  ui.playButton_1->setEnabled(true);
+  ui.playButton_2->setEnabled(true);
+  ui.selectSongButton_1->setEnabled(true);
+  ui.selectSongButton_2->setEnabled(true);
+  ui.testConfirmButton->setEnabled(false);
+  ui.testTypeCombo->setEnabled(false);
+  ui.hqAudioCombo->setEnabled(false);
+  ui.lqAudioCombo->setEnabled(false);
+}
+
+void MainWindow::reportPlayback() {
+  std::string report;
+
+  if (session && session->getPlaybackReport(report)) {
+    QMessageBox::warning(this, STRING_UI_PLAYBACK_WARNING, QString::fromStdString(report));
+  }
 }
 
 ProgressDialog::ProgressDialog(QWidget *parent)
@@ -3,11 +3,16 @@
 
 #include <QtWidgets/QMainWindow>
 #include <QtWidgets/qfiledialog.h>
+#include <QtWidgets/qmessagebox.h>
+#include <QtWidgets/qshortcut.h>
 #include <QtCore/qtimer.h>
 #include "ui_MainWindow.h"
 #include "ui_Progress.h"
 #include "Model.h"
 #include "Audio.h"
+#include "Spectrum.h"
+
+#include <thread>
 
 #define SAFE_DELETE(object)   { if (object) { delete object; object = NULL; } }
 
@@ -17,13 +22,28 @@
 #define STRING_UI_DOWNQUANTIZATION    "Downquantization..."
 #define STRING_UI_PLAYING_FIRST       "Playing First..."
 #define STRING_UI_PLAYING_SECOND      "Playing Second..."
+#define STRING_UI_PLAYBACK_WARNING    "Playback"
+#define STRING_UI_STATION             " - Station "
+#define STRING_UI_TRACE               "Trace"
+#define STRING_UI_SEQUENTIAL          "Sequential test"
+#define STRING_UI_DECIDED             "This condition is already decided, no more trials of it are needed."
+#define STRING_UI_SETTLED             "This answer decided the condition, further trials of it will be skipped."
+#define STRING_UI_DECODE_FAILED       "The song could not be decoded."
+#define STRING_UI_DEVICE              "Output device"
+#define STRING_UI_NO_DEVICE           "No output is left for this station, choose one before playing."
+
+#define PLAYHEAD_INTERVAL_MS          33
+#define PREPARE_POLL_MS               20
+#define TRACE_SHORTCUT                "Ctrl+Shift+T"
+
+class ProgressDialog;
 
 class MainWindow : public QMainWindow
 {
   Q_OBJECT
 
   public:
-    MainWindow(QWidget *parent = NULL);
+    MainWindow(AudioSystem &, int, int, QWidget *parent = NULL);
     ~MainWindow();
 
   private:
@@ -31,10 +51,32 @@ class MainWindow : public QMainWindow
     QTimer timer;
 
     SongModel songModel;
+    SongFilterModel songView;
     ResultModel resultModel;
-    AudioSystem audio;
+
+    // Shared by every station, each one has its own device, tap and session
+    AudioSystem &audio;
+    AudioTap tap;
+    std::vector<OutputDevice> devices;
+    PaDeviceIndex output_device;
+    int station;
+    bool bAudioReady;
 
     SongSession *session;
+    int song_row;                         // in songModel, -1 if none
+    SpectrumWindow *spectrum;
+
+    // readSound of the confirmed trial, the GUI thread never waits on it
+    std::thread preparer;
+    ProgressDialog *progress;
+
+    void reportPlayback();
+    void setupDevices();
+    bool checkDevice();
+    void finishPrepare(bool);
+
+  signals:
+    void prepared(bool);
 };
 
 class ProgressDialog : public QDialog, public Ui_Progress_Dialog {
@@ -1,11 +1,39 @@
 #include "Model.h"
+#include "Trace.h"
 
-Song::Song() {}
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-Song::Song(QString &_filepath, uint32_t _samplingrate, uint8_t _bitdepth) {
+// Seconds, or minutes:seconds
+static uint32_t parseTime(QString &str) {
+  QStringList parts = str.trimmed().split(':');
+  double seconds = 0.0;
+
+  for (auto &part : parts) {
+    seconds = seconds * 60.0 + part.toDouble();
+  }
+
+  return seconds > 0.0 ? (uint32_t)(seconds * 1000.0 + 0.5) : 0;
+}
+
+Song::Song() {
+  samplingrate = 0;
+  bitdepth = 0;
+  duration = 0;
+  excerpt_start = 0;
+  excerpt_end = 0;
+}
+
+Song::Song(QString &_filepath, uint32_t _samplingrate, uint8_t _bitdepth, uint32_t _duration) {
   setData(0, _filepath);
   samplingrate = _samplingrate;
   bitdepth = _bitdepth;
+  duration = _duration;
+  excerpt_start = 0;
+  excerpt_end = 0;
 }
 
 QString Song::getData(int idx) const {
@@ -16,6 +44,12 @@ QString Song::getData(int idx) const {
       return QString::number(samplingrate);
     case 2:
       return QString::number(bitdepth);
+    case 3:
+      return excerpt_start ? QString::number(excerpt_start / 1000.0) : QString();
+    case 4:
+      return excerpt_end ? QString::number(excerpt_end / 1000.0) : QString();
+    case 5:
+      return duration ? QString::number(duration / 1000.0, 'f', 1) : QString();
   }
 
   return QString();
@@ -46,14 +80,46 @@ void Song::setData(int idx, QString &str) {
     case 2:
       bitdepth = (uint8_t)str.toInt();
 
+      break;
+    case 3:
+      excerpt_start = parseTime(str);
+
+      break;
+    case 4:
+      excerpt_end = parseTime(str);
+
       break;
   }
 }
 
-QString Song::getPath() {
+const QString &Song::getPath() const {
   return filepath;
 }
 
+const QString &Song::getFilename() const {
+  return filename;
+}
+
+uint32_t Song::getSamplingrate() const {
+  return samplingrate;
+}
+
+uint8_t Song::getBitdepth() const {
+  return bitdepth;
+}
+
+uint32_t Song::getDuration() const {
+  return duration;
+}
+
+uint32_t Song::getExcerptStart() const {
+  return excerpt_start;
+}
+
+uint32_t Song::getExcerptEnd() const {
+  return excerpt_end;
+}
+
 Result::Result() {}
 
 Result::Result(QString &_filename, TEST_TYPE _type, bool _bFirstSoundIsBetter, bool _bUserSelectFirstSound, uint32_t uiHQ, uint32_t uiLQ, QString &_memo) {
@@ -70,6 +136,84 @@ Result::Result(QString &_filename, TEST_TYPE _type, bool _bFirstSoundIsBetter, b
   factor.append(QString::number(uiFactorLQ));
 }
 
+void Result::setLoudness(double lufsHQ, double lufsLQ, double peakHQ, double peakLQ) {
+  loudness.clear();
+  loudness.append(QString::number(lufsHQ, 'f', 2));
+  loudness.append(" vs ");
+  loudness.append(QString::number(lufsLQ, 'f', 2));
+  loudness.append(" (");
+  loudness.append(QString::number(peakHQ, 'f', 1));
+  loudness.append(" / ");
+  loudness.append(QString::number(peakLQ, 'f', 1));
+  loudness.append(" dBTP)");
+}
+
+static QString formatHash(uint64_t hash) {
+  return QString::number((qulonglong)hash, 16).rightJustified(16, '0');
+}
+
+void Result::setIntegrity(const PlaybackIntegrity &info) {
+  // Frames at the device rate
+  delivered.clear();
+  delivered.append(formatHash(info.delivered));
+  delivered.append(" (");
+  delivered.append(QString::number(info.played_hq));
+  delivered.append(" HQ / ");
+  delivered.append(QString::number(info.played_lq));
+  delivered.append(" LQ frames, ");
+  delivered.append(QString::number(info.skipped));
+  delivered.append(" skipped, ");
+  delivered.append(QString::number(info.misses));
+  delivered.append(" reads missed, ");
+  delivered.append(QString::number(info.silent));
+  delivered.append(" silent)");
+
+  // A stimulus heard start to end without a seek or miss delivered exactly its hash
+  stimulus_hash.clear();
+  stimulus_hash.append(formatHash(info.hash_hq));
+  stimulus_hash.append(" (");
+  stimulus_hash.append(info.delivered_hq == info.hash_hq ? QString(STRING_HASH_COMPLETE) : QString(STRING_HASH_DELIVERED) + formatHash(info.delivered_hq));
+  stimulus_hash.append(") / ");
+  stimulus_hash.append(formatHash(info.hash_lq));
+  stimulus_hash.append(" (");
+  stimulus_hash.append(info.delivered_lq == info.hash_lq ? QString(STRING_HASH_COMPLETE) : QString(STRING_HASH_DELIVERED) + formatHash(info.delivered_lq));
+  stimulus_hash.append(")");
+}
+
+void Result::setSequential(QString &str) {
+  sequential = str;
+}
+
+void Result::setExcerpt(uint32_t start, uint32_t end) {
+  // ms, an end of 0 is the end of the song
+  excerpt.clear();
+
+  if (start == 0 && end == 0) {
+    excerpt.append(STRING_EXCERPT_WHOLE);
+  }
+  else {
+    excerpt.append(QString::number(start / 1000.0));
+    excerpt.append(" - ");
+    excerpt.append(end ? QString::number(end / 1000.0) : QString(STRING_EXCERPT_END));
+  }
+}
+
+Result::TEST_TYPE Result::getType() const {
+  return type;
+}
+
+uint32_t Result::getFactorHQ() const {
+  return uiFactorHQ;
+}
+
+uint32_t Result::getFactorLQ() const {
+  return uiFactorLQ;
+}
+
+bool Result::isCorrect() const {
+  return bFirstSoundIsBetter == bUserSelectFirstSound;
+}
+
 QString Result::getData(int idx) const {
   switch (idx) {
     case 0:
@@ -84,6 +228,16 @@ QString Result::getData(int idx) const {
       return bUserSelectFirstSound ? STRING_TEST_FIRST : STRING_TEST_SECOND;
     case 5:
       return memo;
+    case 6:
+      return loudness;
+    case 7:
+      return delivered;
+    case 8:
+      return stimulus_hash;
+    case 9:
+      return sequential;
+    case 10:
+      return excerpt;
   }
 
   return QString();
@@ -133,6 +287,63 @@ void Result::setData(int idx, QString &str) {
   }
 }
 
+SongFilter::SongFilter() {
+  samplingrate = 0;
+  bitdepth = 0;
+  min_duration = 0;
+  max_duration = 0;
+}
+
+SongFilter SongFilter::parse(const QString &text) {
+  SongFilter filter;
+  QStringList words;
+
+  for (auto &word : text.split(' ', QString::SkipEmptyParts)) {
+    QString value = word.mid(word.indexOf(':') + 1);
+
+    if (word.startsWith("rate:")) {
+      filter.samplingrate = value.toUInt();
+    }
+    else if (word.startsWith("bits:")) {
+      filter.bitdepth = value.toUInt();
+    }
+    else if (word.startsWith("min:")) {
+      filter.min_duration = parseTime(value);
+    }
+    else if (word.startsWith("max:")) {
+      filter.max_duration = parseTime(value);
+    }
+    else if (word.startsWith("path:")) {
+      filter.path_prefix = value;
+    }
+    else {
+      words.append(word);
+    }
+  }
+
+  filter.search = words.join(' ').toLower();
+
+  return filter;
+}
+
+bool SongFilter::isNarrowing(const SongFilter &previous) const {
+  // Songs matching this filter are a subset of the previous ones
+  return samplingrate == previous.samplingrate && bitdepth == previous.bitdepth &&
+         min_duration == previous.min_duration && max_duration == previous.max_duration &&
+         path_prefix == previous.path_prefix && search.contains(previous.search);
+}
+
+template <class Iterator>
+static std::vector<int> collectRows(Iterator first, Iterator last) {
+  std::vector<int> rows;
+
+  for (; first != last; ++first) {
+    rows.push_back(first->second);
+  }
+
+  return rows;
+}
+
 SongModel::SongModel(QObject *parent)
   : QAbstractTableModel(parent) {}
 
@@ -165,6 +376,12 @@ QVariant SongModel::headerData(int section, Qt::Orientation orientation, int rol
         return STRING_LIST_SAMPLINGRATE;
       case 2:
         return STRING_LIST_BITDEPTH;
+      case 3:
+        return STRING_LIST_EXCERPT_START;
+      case 4:
+        return STRING_LIST_EXCERPT_END;
+      case 5:
+        return STRING_LIST_DURATION;
       default:
         return QVariant();
     }
@@ -174,32 +391,454 @@ QVariant SongModel::headerData(int section, Qt::Orientation orientation, int rol
   }
 }
 
+bool SongModel::setData(const QModelIndex &index, const QVariant &value, int role) {
+  if (role == Qt::EditRole) {
+    if (index.column() == 3 || index.column() == 4) {
+      QString str = value.toString();
+      vSongs.at(index.row()).setData(index.column(), str);
+
+      emit dataChanged(index, index);
+    }
+  }
+
+  return true;
+}
+
+Qt::ItemFlags SongModel::flags(const QModelIndex &index) const {
+  if (index.column() == 3 || index.column() == 4) {
+    return QAbstractTableModel::flags(index) | Qt::ItemIsEditable;
+  }
+
+  return QAbstractTableModel::flags(index);
+}
+
+void SongModel::addIndex(int row) {
+  const Song &song = vSongs[row];
+
+  by_samplingrate.emplace(song.getSamplingrate(), row);
+  by_bitdepth.emplace(song.getBitdepth(), row);
+  by_duration.emplace(song.getDuration(), row);
+  by_path.emplace(song.getPath(), row);
+}
+
+template <class Index>
+static void eraseRow(Index &index, int row) {
+  for (auto it = index.begin(); it != index.end();) {
+    if (it->second == row) {
+      it = index.erase(it);
+      continue;
+    }
+
+    // Rows after the removed one move up by one, keys stay where they are
+    if (it->second > row) {
+      it->second--;
+    }
+
+    ++it;
+  }
+}
+
+void SongModel::removeIndex(int row) {
+  eraseRow(by_samplingrate, row);
+  eraseRow(by_bitdepth, row);
+  eraseRow(by_duration, row);
+  eraseRow(by_path, row);
+}
+
 void SongModel::appendSong(Song &song) {
   beginInsertRows(QModelIndex{}, vSongs.size(), vSongs.size());
   vSongs.push_back(song);
+  names.push_back(song.getFilename().toLower());
+  addIndex(vSongs.size() - 1);
   endInsertRows();
 }
 
 void SongModel::removeSong(int idx) {
-  if ((size_t)idx >= vSongs.size()) {
+  if (idx < 0 || (size_t)idx >= vSongs.size()) {
     return;
   }
 
   beginRemoveRows(QModelIndex{}, idx, idx);
   vSongs.erase(vSongs.begin() + idx);
+  names.erase(names.begin() + idx);
+  removeIndex(idx);
   endRemoveRows();
 }
 
-Song SongModel::getItem(int idx) {
-  if ((size_t)idx >= vSongs.size()) {
-    return Song();
+const Song &SongModel::getItem(int idx) const {
+  static const Song empty;
+
+  if (idx < 0 || (size_t)idx >= vSongs.size()) {
+    return empty;
+  }
+
+  return vSongs[idx];
+}
+
+bool SongModel::matches(int row, const SongFilter &filter) const {
+  const Song &song = vSongs[row];
+
+  return (filter.samplingrate == 0 || song.getSamplingrate() == filter.samplingrate) &&
+         (filter.bitdepth == 0 || song.getBitdepth() == filter.bitdepth) &&
+         song.getDuration() >= filter.min_duration &&
+         (filter.max_duration == 0 || song.getDuration() <= filter.max_duration) &&
+         (filter.path_prefix.isEmpty() || song.getPath().startsWith(filter.path_prefix)) &&
+         (filter.search.isEmpty() || names[row].contains(filter.search));
+}
+
+void SongModel::query(const SongFilter &filter, std::vector<int> &rows) const {
+  std::vector<int> candidates;
+  bool bIndexed = false;
+
+  // Candidates come from the index with the fewest songs, the rest of the
+  // filter is checked on those only
+  auto narrow = [&](std::vector<int> found) {
+    if (!bIndexed || found.size() < candidates.size()) {
+      candidates.swap(found);
+      bIndexed = true;
+    }
+  };
+
+  if (filter.samplingrate) {
+    auto range = by_samplingrate.equal_range(filter.samplingrate);
+
+    narrow(collectRows(range.first, range.second));
+  }
+  if (filter.bitdepth) {
+    auto range = by_bitdepth.equal_range(filter.bitdepth);
+
+    narrow(collectRows(range.first, range.second));
+  }
+  if (filter.min_duration || filter.max_duration) {
+    auto last = filter.max_duration ? by_duration.upper_bound(filter.max_duration) : by_duration.end();
+
+    narrow(collectRows(by_duration.lower_bound(filter.min_duration), last));
+  }
+  if (!filter.path_prefix.isEmpty()) {
+    auto first = by_path.lower_bound(filter.path_prefix);
+    auto last = first;
+
+    while (last != by_path.end() && last->first.startsWith(filter.path_prefix)) {
+      ++last;
+    }
+
+    narrow(collectRows(first, last));
+  }
+
+  rows.clear();
+
+  if (bIndexed) {
+    for (auto row : candidates) {
+      if (matches(row, filter)) {
+        rows.push_back(row);
+      }
+    }
+
+    std::sort(rows.begin(), rows.end());
+  }
+  else {
+    for (int row = 0; row < (int)vSongs.size(); row++) {
+      if (filter.search.isEmpty() || names[row].contains(filter.search)) {
+        rows.push_back(row);
+      }
+    }
+  }
+}
+
+bool SongModel::lessThan(int a, int b, int column) const {
+  const Song &x = vSongs[a];
+  const Song &y = vSongs[b];
+  int compare = 0;
+
+  switch (column) {
+    case 0:
+      compare = names[a].compare(names[b]);
+      break;
+    case 1:
+      compare = (x.getSamplingrate() > y.getSamplingrate()) - (x.getSamplingrate() < y.getSamplingrate());
+      break;
+    case 2:
+      compare = (x.getBitdepth() > y.getBitdepth()) - (x.getBitdepth() < y.getBitdepth());
+      break;
+    case 3:
+      compare = (x.getExcerptStart() > y.getExcerptStart()) - (x.getExcerptStart() < y.getExcerptStart());
+      break;
+    case 4:
+      compare = (x.getExcerptEnd() > y.getExcerptEnd()) - (x.getExcerptEnd() < y.getExcerptEnd());
+      break;
+    case 5:
+      compare = (x.getDuration() > y.getDuration()) - (x.getDuration() < y.getDuration());
+      break;
+  }
+
+  // Equal songs stay in the order they were added
+  return compare != 0 ? compare < 0 : a < b;
+}
+
+SongFilterModel::SongFilterModel(SongModel *_source, QObject *parent)
+  : QAbstractTableModel(parent) {
+  source = _source;
+  fetched = 0;
+  sort_column = -1;
+  sort_order = Qt::AscendingOrder;
+
+  connect(source, &QAbstractItemModel::rowsInserted, [&](const QModelIndex &, int first, int last) {
+    sourceInserted(first, last);
+  });
+  connect(source, &QAbstractItemModel::rowsAboutToBeRemoved, [&](const QModelIndex &, int first, int last) {
+    sourceAboutToBeRemoved(first, last);
+  });
+  connect(source, &QAbstractItemModel::rowsRemoved, [&](const QModelIndex &, int first, int last) {
+    sourceRemoved(first, last);
+  });
+  connect(source, &QAbstractItemModel::dataChanged, [&](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+    sourceChanged(topLeft, bottomRight);
+  });
+
+  refilter();
+}
+
+int SongFilterModel::rowCount(const QModelIndex &) const {
+  return fetched;
+}
+
+int SongFilterModel::columnCount(const QModelIndex &) const {
+  return COLUMN_COUNT_SONG;
+}
+
+QVariant SongFilterModel::data(const QModelIndex &index, int role) const {
+  if (role != Qt::DisplayRole && role != Qt::EditRole) {
+    return QVariant();
+  }
+
+  return source->getItem(rows.at(index.row())).getData(index.column());
+}
+
+QVariant SongFilterModel::headerData(int section, Qt::Orientation orientation, int role) const {
+  return source->headerData(section, orientation, role);
+}
+
+bool SongFilterModel::setData(const QModelIndex &index, const QVariant &value, int role) {
+  // Comes back through sourceChanged
+  return source->setData(source->index(rows.at(index.row()), index.column()), value, role);
+}
+
+Qt::ItemFlags SongFilterModel::flags(const QModelIndex &index) const {
+  if (index.column() == 3 || index.column() == 4) {
+    return QAbstractTableModel::flags(index) | Qt::ItemIsEditable;
+  }
+
+  return QAbstractTableModel::flags(index);
+}
+
+void SongFilterModel::sort(int column, Qt::SortOrder order) {
+  std::vector<int> previous = rows;
+
+  emit layoutAboutToBeChanged();
+
+  sort_column = column;
+  sort_order = order;
+  sortRows();
+
+  // The selection follows its song
+  QModelIndexList from = persistentIndexList();
+  QModelIndexList to;
+
+  for (auto &item : from) {
+    int position = findRow(previous[item.row()]);
+
+    to.append(position < fetched ? index(position, item.column()) : QModelIndex());
+  }
+
+  changePersistentIndexList(from, to);
+
+  emit layoutChanged();
+}
+
+bool SongFilterModel::canFetchMore(const QModelIndex &parent) const {
+  return !parent.isValid() && fetched < (int)rows.size();
+}
+
+void SongFilterModel::fetchMore(const QModelIndex &parent) {
+  int count = std::min<int>(LIBRARY_FETCH_ROWS, (int)rows.size() - fetched);
+
+  if (parent.isValid() || count <= 0) {
+    return;
+  }
+
+  beginInsertRows(QModelIndex{}, fetched, fetched + count - 1);
+  fetched += count;
+  endInsertRows();
+}
+
+void SongFilterModel::setFilter(const SongFilter &next) {
+  // Typing on in the search box only drops rows, the order stays, so the
+  // view keeps its selection and scroll position
+  if (next.isNarrowing(filter)) {
+    auto dropped = [&](int row) { return !source->matches(row, next); };
+
+    // Rows past the fetched ones were never shown
+    rows.erase(std::remove_if(rows.begin() + fetched, rows.end(), dropped), rows.end());
+
+    // Shown ones go run by run from the back, so earlier positions hold
+    for (int last = fetched - 1; last >= 0; last--) {
+      if (!dropped(rows[last])) {
+        continue;
+      }
+
+      int first = last;
+
+      while (first > 0 && dropped(rows[first - 1])) {
+        first--;
+      }
+
+      beginRemoveRows(QModelIndex{}, first, last);
+      rows.erase(rows.begin() + first, rows.begin() + last + 1);
+      fetched -= last - first + 1;
+      endRemoveRows();
+
+      last = first;
+    }
+
+    filter = next;
+
+    return;
+  }
+
+  beginResetModel();
+
+  source->query(next, rows);
+  sortRows();
+
+  filter = next;
+  fetched = std::min<int>(LIBRARY_FETCH_ROWS, (int)rows.size());
+
+  endResetModel();
+}
+
+int SongFilterModel::mapToSource(int row) const {
+  return row >= 0 && row < (int)rows.size() ? rows[row] : -1;
+}
+
+void SongFilterModel::refilter() {
+  beginResetModel();
+
+  source->query(filter, rows);
+  sortRows();
+  fetched = std::min<int>(LIBRARY_FETCH_ROWS, (int)rows.size());
+
+  endResetModel();
+}
+
+void SongFilterModel::sortRows() {
+  if (sort_column < 0) {
+    std::sort(rows.begin(), rows.end());
+  }
+  else {
+    std::sort(rows.begin(), rows.end(), [&](int a, int b) { return before(a, b); });
+  }
+}
+
+bool SongFilterModel::before(int a, int b) const {
+  if (sort_column < 0) {
+    return a < b;
+  }
+
+  return sort_order == Qt::AscendingOrder ? source->lessThan(a, b, sort_column) : source->lessThan(b, a, sort_column);
+}
+
+int SongFilterModel::findRow(int row) const {
+  auto found = std::find(rows.begin(), rows.end(), row);
+
+  return found != rows.end() ? (int)(found - rows.begin()) : -1;
+}
+
+void SongFilterModel::sourceInserted(int first, int last) {
+  // The source only appends, rows already here keep their numbers
+  for (int row = first; row <= last; row++) {
+    if (!source->matches(row, filter)) {
+      continue;
+    }
+
+    int position = (int)(std::upper_bound(rows.begin(), rows.end(), row, [&](int a, int b) { return before(a, b); }) - rows.begin());
+
+    // Rows past the fetched ones are handed out by fetchMore
+    if (position < fetched || fetched < LIBRARY_FETCH_ROWS) {
+      beginInsertRows(QModelIndex{}, position, position);
+      rows.insert(rows.begin() + position, row);
+      fetched++;
+      endInsertRows();
+    }
+    else {
+      rows.insert(rows.begin() + position, row);
+    }
+  }
+}
+
+void SongFilterModel::sourceAboutToBeRemoved(int first, int last) {
+  for (int position = (int)rows.size() - 1; position >= 0; position--) {
+    if (rows[position] < first || rows[position] > last) {
+      continue;
+    }
+
+    if (position < fetched) {
+      beginRemoveRows(QModelIndex{}, position, position);
+      rows.erase(rows.begin() + position);
+      fetched--;
+      endRemoveRows();
+    }
+    else {
+      rows.erase(rows.begin() + position);
+    }
+  }
+}
+
+void SongFilterModel::sourceRemoved(int first, int last) {
+  for (auto &row : rows) {
+    row -= row > last ? last - first + 1 : 0;
   }
+}
+
+void SongFilterModel::sourceChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+  for (int row = topLeft.row(); row <= bottomRight.row(); row++) {
+    int position = findRow(row);
 
-  return vSongs.at(idx);
+    if (position >= 0 && position < fetched) {
+      emit dataChanged(index(position, topLeft.column()), index(position, bottomRight.column()));
+    }
+  }
+}
+
+SequentialTest::SequentialTest() {
+  decision = DECISION_OPEN;
+  llr = 0.0;
+  trials = 0;
+  correct = 0;
 }
 
 ResultModel::ResultModel(QObject *parent)
-  :QAbstractTableModel(parent) {}
+  :QAbstractTableModel(parent) {
+  const char *env = getenv(SPRT_ENV);
+  double p1 = SPRT_P1;
+  double alpha = SPRT_ALPHA;
+  double beta = SPRT_BETA;
+
+  bSequential = env && *env && strcmp(env, "0") != 0;
+
+  if (bSequential && strchr(env, ',')) {
+    sscanf(env, "%lf,%lf,%lf", &p1, &alpha, &beta);
+  }
+
+  p1 = p1 > SPRT_P0 && p1 < 1.0 ? p1 : SPRT_P1;
+  alpha = alpha > 0.0 && alpha < 0.5 ? alpha : SPRT_ALPHA;
+  beta = beta > 0.0 && beta < 0.5 ? beta : SPRT_BETA;
+
+  // Each answer moves the ratio by one of two steps, Wald's bounds end it
+  llr_correct = log(p1 / SPRT_P0);
+  llr_wrong = log((1.0 - p1) / (1.0 - SPRT_P0));
+  bound_audible = log((1.0 - beta) / alpha);
+  bound_inaudible = log(beta / (1.0 - alpha));
+}
 
 int ResultModel::rowCount(const QModelIndex &) const {
   return vResults.size();
@@ -236,6 +875,16 @@ QVariant ResultModel::headerData(int section, Qt::Orientation orientation, int r
       return STRING_LIST_RESPONSE;
     case 5:
       return STRING_LIST_MEMO;
+    case 6:
+      return STRING_LIST_LOUDNESS;
+    case 7:
+      return STRING_LIST_DELIVERED;
+    case 8:
+      return STRING_LIST_STIMULUS_HASH;
+    case 9:
+      return STRING_LIST_SEQUENTIAL;
+    case 10:
+      return STRING_LIST_EXCERPT;
     default:
       return QVariant();
     }
@@ -264,19 +913,74 @@ Qt::ItemFlags ResultModel::flags(const QModelIndex &index) const {
   return QAbstractTableModel::flags(index);
 }
 
-void ResultModel::appendResult(Result & result) {
+bool ResultModel::appendResult(Result & result) {
+  bool bSettled = false;
+
+  if (bSequential) {
+    SequentialTest &test = conditions[Condition(result.getType(), result.getFactorHQ(), result.getFactorLQ())];
+    QString state;
+
+    // Answers after the decision are recorded but don't move it
+    if (test.decision == SequentialTest::DECISION_OPEN) {
+      test.llr += result.isCorrect() ? llr_correct : llr_wrong;
+      test.trials++;
+      test.correct += result.isCorrect() ? 1 : 0;
+
+      if (test.llr >= bound_audible) {
+        test.decision = SequentialTest::DECISION_AUDIBLE;
+        bSettled = true;
+      }
+      else if (test.llr <= bound_inaudible) {
+        test.decision = SequentialTest::DECISION_INAUDIBLE;
+        bSettled = true;
+      }
+    }
+
+    switch (test.decision) {
+      case SequentialTest::DECISION_AUDIBLE:
+        state = STRING_SPRT_AUDIBLE;
+        break;
+      case SequentialTest::DECISION_INAUDIBLE:
+        state = STRING_SPRT_INAUDIBLE;
+        break;
+      default:
+        state = STRING_SPRT_OPEN;
+        break;
+    }
+
+    state.append(", ");
+    state.append(QString::number(test.correct));
+    state.append(" / ");
+    state.append(QString::number(test.trials));
+    state.append(" right (LLR ");
+    state.append(QString::number(test.llr, 'f', 2));
+    state.append(")");
+
+    result.setSequential(state);
+  }
+
   beginInsertRows(QModelIndex{}, vResults.size(), vResults.size());
   vResults.push_back(result);
   endInsertRows();
+
+  return bSettled;
 }
 
 void ResultModel::resetList() {
   beginRemoveRows(QModelIndex{}, 0, vResults.size() - 1);
   vResults.clear();
+  conditions.clear();
   endRemoveRows();
 }
 
+SequentialTest::DECISION ResultModel::getDecision(Result::TEST_TYPE type, uint32_t factorHQ, uint32_t factorLQ) const {
+  auto found = conditions.find(Condition(type, factorHQ, factorLQ));
+
+  return found != conditions.end() ? found->second.decision : SequentialTest::DECISION_OPEN;
+}
+
 bool ResultModel::saveList(QString &path) {
+  TRACE_SCOPE("saveList");
   lxw_workbook *wb = workbook_new(path.toStdString().c_str());
 
   if (wb) {
@@ -289,6 +993,11 @@ bool ResultModel::saveList(QString &path) {
     worksheet_write_string(ws, 0, 3, STRING_LIST_ANSWER, NULL);
     worksheet_write_string(ws, 0, 4, STRING_LIST_RESPONSE, NULL);
     worksheet_write_string(ws, 0, 5, STRING_LIST_MEMO, NULL);
+    worksheet_write_string(ws, 0, 6, STRING_LIST_LOUDNESS, NULL);
+    worksheet_write_string(ws, 0, 7, STRING_LIST_DELIVERED, NULL);
+    worksheet_write_string(ws, 0, 8, STRING_LIST_STIMULUS_HASH, NULL);
+    worksheet_write_string(ws, 0, 9, STRING_LIST_SEQUENTIAL, NULL);
+    worksheet_write_string(ws, 0, 10, STRING_LIST_EXCERPT, NULL);
 
     // Write data
     int rowidx = 1;
@@ -6,6 +6,8 @@
 #include <QtCore/qabstractitemmodel.h>
 #include <QtCore/qfile.h>
 #include <vector>
+#include <map>
+#include <tuple>
 #include <xlsxwriter.h>
 
 #ifdef WIN32
@@ -30,9 +32,35 @@
 #define STRING_LIST_ANSWER            "Answer"
 #define STRING_LIST_RESPONSE          "Response"
 #define STRING_LIST_MEMO              "Memo"
+#define STRING_LIST_LOUDNESS          "Loudness (LUFS)"
+#define STRING_LIST_EXCERPT_START     "Start (s)"
+#define STRING_LIST_EXCERPT_END       "End (s)"
+#define STRING_LIST_DURATION          "Length (s)"
+#define STRING_LIST_DELIVERED         "Delivered"
+#define STRING_LIST_STIMULUS_HASH     "Stimulus hash (HQ / LQ)"
+#define STRING_LIST_SEQUENTIAL        "Sequential test"
+#define STRING_LIST_EXCERPT           "Excerpt (s)"
 
-#define COLUMN_COUNT_SONG             3
-#define COLUMN_COUNT_RESULT           6
+#define STRING_SPRT_OPEN              "Open"
+#define STRING_SPRT_AUDIBLE           "Audible"
+#define STRING_SPRT_INAUDIBLE         "Not audible"
+
+#define STRING_EXCERPT_WHOLE          "Whole song"
+#define STRING_EXCERPT_END            "end"
+
+#define STRING_HASH_COMPLETE          "played through"
+#define STRING_HASH_DELIVERED         "delivered "
+
+#define COLUMN_COUNT_SONG             6
+#define COLUMN_COUNT_RESULT           11
+
+#define LIBRARY_FETCH_ROWS            256     // rows a view is given at once
+
+#define SPRT_ENV                      "LISTENING_TEST_SPRT"   // p1,alpha,beta, or 1 for the defaults
+#define SPRT_P0                       0.5     // guessing, the difference isn't heard
+#define SPRT_P1                       0.75    // answers right this often count as heard
+#define SPRT_ALPHA                    0.05    // chance to call a guesser's condition audible
+#define SPRT_BETA                     0.05    // chance to call a heard condition inaudible
 
 class Song {
   private:
@@ -41,14 +69,39 @@ class Song {
     QString filename;
     uint32_t samplingrate;
     uint8_t bitdepth;
+    uint32_t duration;                    // ms, 0 if unknown
+
+    // Only this part of the song is prepared and played, ms
+    uint32_t excerpt_start;
+    uint32_t excerpt_end;                 // 0 is the end of the song
 
   public:
-    Song(QString &, uint32_t, uint8_t);
+    Song(QString &, uint32_t, uint8_t, uint32_t);
     Song();
 
     QString getData(int) const;
     void setData(int, QString &);
-    QString getPath();
+    const QString &getPath() const;
+    const QString &getFilename() const;
+    uint32_t getSamplingrate() const;
+    uint8_t getBitdepth() const;
+    uint32_t getDuration() const;
+    uint32_t getExcerptStart() const;
+    uint32_t getExcerptEnd() const;
+};
+
+// What a trial actually played. Frame counts are at the device rate.
+struct PlaybackIntegrity {
+  uint64_t delivered;                   // xxHash64 of every audible device buffer
+  uint64_t played_hq;
+  uint64_t played_lq;
+  uint64_t skipped;                     // jumped over by seeks
+  uint64_t misses;                      // ring reads the feeder hadn't decoded
+  uint64_t silent;                      // frames those misses left silent
+  uint64_t delivered_hq;                // xxHash64 of the source frames each
+  uint64_t delivered_lq;                // stimulus delivered, in order
+  uint64_t hash_hq;                     // of the stored stimuli, equal to the
+  uint64_t hash_lq;                     // above after a plain play-through
 };
 
 class Result {
@@ -67,18 +120,63 @@ class Result {
     uint32_t uiFactorLQ;
     QString memo;
     QString factor;
+    QString loudness;
+    QString delivered;
+    QString stimulus_hash;
+    QString sequential;
+    QString excerpt;
 
   public:
     Result(QString &, TEST_TYPE, bool, bool, uint32_t, uint32_t, QString &);
     Result();
 
+    void setLoudness(double, double, double, double);
+    void setIntegrity(const PlaybackIntegrity &);
+    void setSequential(QString &);
+    void setExcerpt(uint32_t, uint32_t);
+
+    TEST_TYPE getType() const;
+    uint32_t getFactorHQ() const;
+    uint32_t getFactorLQ() const;
+    bool isCorrect() const;
+
     QString getData(int) const;
     void setData(int, QString &);
 };
 
+// Which songs the library shows, a zero or empty field matches every song
+struct SongFilter {
+  uint32_t samplingrate;
+  uint32_t bitdepth;
+  uint32_t min_duration;                // ms
+  uint32_t max_duration;                // ms, 0 is no limit
+  QString path_prefix;
+  QString search;                       // part of the file name, lower case
+
+  SongFilter();
+
+  // Words of a search box: rate:96000, bits:24, min:60, max:300 (seconds),
+  // path:<prefix>, everything else is searched in file names
+  static SongFilter parse(const QString &);
+
+  bool isNarrowing(const SongFilter &) const;
+};
+
+// Every song of the station. Rows are kept in the order they were added, with
+// secondary indexes so a filter only looks at the songs it can match.
 class SongModel : public QAbstractTableModel {
   private:
     std::vector<Song> vSongs;
+    std::vector<QString> names;           // lower case file names
+
+    // Value to row, rebuilt when rows move
+    std::multimap<uint32_t, int> by_samplingrate;
+    std::multimap<uint32_t, int> by_bitdepth;
+    std::multimap<uint32_t, int> by_duration;
+    std::multimap<QString, int> by_path;
+
+    void addIndex(int);
+    void removeIndex(int);
 
   public:
     SongModel(QObject *parent = NULL);
@@ -87,16 +185,87 @@ class SongModel : public QAbstractTableModel {
     int columnCount(const QModelIndex &) const override;
     QVariant data(const QModelIndex &, int) const override;
     QVariant headerData(int, Qt::Orientation, int) const override;
+    bool setData(const QModelIndex &, const QVariant &, int role = Qt::EditRole) override;
+    Qt::ItemFlags flags(const QModelIndex &) const override;
 
     void appendSong(Song &);
     void removeSong(int);
-    Song getItem(int);
+    const Song &getItem(int) const;
+
+    bool matches(int, const SongFilter &) const;
+    void query(const SongFilter &, std::vector<int> &) const;
+    bool lessThan(int, int, int) const;
+};
+
+// Filtered and sorted view of a SongModel. Holds source rows only, never
+// songs, and hands them to the view LIBRARY_FETCH_ROWS at a time.
+class SongFilterModel : public QAbstractTableModel {
+  private:
+    SongModel *source;
+    SongFilter filter;
+    std::vector<int> rows;                // source rows in view order
+    int fetched;
+    int sort_column;                      // -1 keeps the source order
+    Qt::SortOrder sort_order;
+
+    void refilter();
+    void sortRows();
+    bool before(int, int) const;
+    int findRow(int) const;
+
+    void sourceInserted(int, int);
+    void sourceAboutToBeRemoved(int, int);
+    void sourceRemoved(int, int);
+    void sourceChanged(const QModelIndex &, const QModelIndex &);
+
+  public:
+    SongFilterModel(SongModel *, QObject *parent = NULL);
+
+    int rowCount(const QModelIndex &) const override;
+    int columnCount(const QModelIndex &) const override;
+    QVariant data(const QModelIndex &, int) const override;
+    QVariant headerData(int, Qt::Orientation, int) const override;
+    bool setData(const QModelIndex &, const QVariant &, int role = Qt::EditRole) override;
+    Qt::ItemFlags flags(const QModelIndex &) const override;
+    void sort(int, Qt::SortOrder order = Qt::AscendingOrder) override;
+    bool canFetchMore(const QModelIndex &) const override;
+    void fetchMore(const QModelIndex &) override;
+
+    void setFilter(const SongFilter &);
+    int mapToSource(int) const;
+};
+
+// Wald's sequential probability ratio test on the answers of one condition,
+// guessing (SPRT_P0) against hearing the difference (p1)
+struct SequentialTest {
+  enum DECISION {
+    DECISION_OPEN,
+    DECISION_AUDIBLE,
+    DECISION_INAUDIBLE
+  };
+
+  DECISION decision;
+  double llr;                           // log likelihood ratio so far
+  uint32_t trials;
+  uint32_t correct;
+
+  SequentialTest();
 };
 
 class ResultModel : public QAbstractTableModel {
   private:
+    typedef std::tuple<int, uint32_t, uint32_t> Condition;   // test type, HQ, LQ
+
     std::vector<Result> vResults;
 
+    // Off unless SPRT_ENV is set
+    bool bSequential;
+    double llr_correct;
+    double llr_wrong;
+    double bound_audible;
+    double bound_inaudible;
+    std::map<Condition, SequentialTest> conditions;
+
   public:
     ResultModel(QObject *parent = NULL);
 
@@ -107,9 +276,13 @@ class ResultModel : public QAbstractTableModel {
     bool setData(const QModelIndex &, const QVariant &, int role = Qt::EditRole) override;
     Qt::ItemFlags flags(const QModelIndex &) const override;
 
-    void appendResult(Result &);
+    // True when this result settled its condition
+    bool appendResult(Result &);
     void resetList();
     bool saveList(QString &);
+
+    // Conditions settled by the sequential test need no more stimuli
+    SequentialTest::DECISION getDecision(Result::TEST_TYPE, uint32_t, uint32_t) const;
 };
 
 #endif
@@ -0,0 +1,116 @@
+#include "RealTime.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+static size_t pageSize() {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+
+  return info.dwPageSize;
+#else
+  return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+void RealTime::prefault(const void *data, size_t length) {
+  const volatile char *ptr = (const volatile char *)data;
+  size_t page = pageSize();
+  char sink = 0;
+
+  for (size_t i = 0; i < length; i += page) {
+    sink ^= ptr[i];
+  }
+
+  if (length > 0) {
+    sink ^= ptr[length - 1];
+  }
+
+  (void)sink;
+}
+
+bool RealTime::lockMemory(const void *data, size_t length, std::string &error) {
+  if (data == NULL || length == 0) {
+    return true;
+  }
+
+#ifdef _WIN32
+  SIZE_T min_ws, max_ws;
+
+  // VirtualLock is bounded by the working set, grow it first
+  if (GetProcessWorkingSetSize(GetCurrentProcess(), &min_ws, &max_ws)) {
+    SetProcessWorkingSetSize(GetCurrentProcess(), min_ws + length, max_ws + length);
+  }
+
+  if (!VirtualLock((LPVOID)data, length)) {
+    error = "VirtualLock failed (error " + std::to_string(GetLastError()) + "), stimulus may be paged out during playback";
+
+    return false;
+  }
+#else
+  if (mlock(data, length) != 0) {
+    error = std::string("mlock failed (") + strerror(errno) + "), raise RLIMIT_MEMLOCK (ulimit -l) to page-lock the stimulus";
+
+    return false;
+  }
+#endif
+
+  return true;
+}
+
+void RealTime::unlockMemory(const void *data, size_t length) {
+  if (data == NULL || length == 0) {
+    return;
+  }
+
+#ifdef _WIN32
+  VirtualUnlock((LPVOID)data, length);
+#else
+  munlock(data, length);
+#endif
+}
+
+int RealTime::promoteThread() {
+  // Runs on the audio thread, so report an error code and format it later
+#if defined(_WIN32)
+  if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+    return (int)GetLastError();
+  }
+#elif defined(__APPLE__)
+  // CoreAudio already runs the IO proc on a time-constraint thread
+#else
+  struct sched_param param;
+  int policy;
+
+  if (pthread_getschedparam(pthread_self(), &policy, &param) == 0 && (policy == SCHED_FIFO || policy == SCHED_RR)) {
+    return PROMOTE_OK;
+  }
+
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+
+  return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+
+  return PROMOTE_OK;
+}
+
+std::string RealTime::describePromoteError(int code) {
+#ifdef _WIN32
+  return "SetThreadPriority failed (error " + std::to_string(code) + "), callback runs at normal priority";
+#else
+  return std::string("SCHED_FIFO denied (") + strerror(code) + "), grant rtprio to the user or CAP_SYS_NICE to the binary";
+#endif
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef _REALTIME_H_
+#define _REALTIME_H_
+
+#include <string>
+#include <stdint.h>
+
+#define PROMOTE_PENDING     -1
+#define PROMOTE_OK          0
+
+// Helpers for the opt-in real-time playback mode: page-locking the stimulus
+// and raising the callback thread priority.
+class RealTime {
+  public:
+    static void prefault(const void *, size_t);
+    static bool lockMemory(const void *, size_t, std::string &);
+    static void unlockMemory(const void *, size_t);
+
+    static int promoteThread();
+    static std::string describePromoteError(int);
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "Resampler.h"
+#include "Dispatch.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+  while (b) {
+    uint32_t t = a % b;
+
+    a = b;
+    b = t;
+  }
+
+  return a;
+}
+
+Resampler::Resampler() {
+  setRatio(1, 1);
+}
+
+void Resampler::setRatio(uint32_t in_rate, uint32_t out_rate) {
+  uint32_t g = gcd(in_rate, out_rate);
+
+  up = out_rate / g;
+  down = in_rate / g;
+
+  if (isIdentity()) {
+    taps = 1;
+    delay = 0;
+    coef.assign(1, 1.f);
+
+    return;
+  }
+
+  // Keep the transition band constant relative to the lower rate
+  taps = RESAMPLER_TAPS * (down > up ? (down + up - 1) / up : 1);
+  taps = taps < SEGMENT_GUARD_FRAMES ? taps : SEGMENT_GUARD_FRAMES;
+
+  uint64_t length = (uint64_t)up * taps;
+  double cutoff = 0.5 * RESAMPLER_CUTOFF / (up > down ? up : down);  // cycles per upsampled sample
+
+  delay = length / 2;
+  coef.resize(length);
+
+  // Prototype at the upsampled rate, centered on delay. Blackman is zero at
+  // both ends so the odd-length symmetric kernel fits in up * taps slots.
+  for (uint32_t p = 0; p < up; p++) {
+    for (uint32_t k = 0; k < taps; k++) {
+      uint64_t m = p + (uint64_t)k * up;
+      double x = (double)m - delay;
+      double sinc = x == 0.0 ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+      double w = 0.42 - 0.5 * cos(2.0 * M_PI * m / length) + 0.08 * cos(4.0 * M_PI * m / length);
+
+      // Zero stuffing loses a factor of up in level. Stored oldest tap first
+      // so the dot product walks the source forward.
+      coef[p * taps + (taps - 1 - k)] = (float)(sinc * w * up);
+    }
+  }
+}
+
+bool Resampler::isIdentity() const {
+  return up == down;
+}
+
+uint64_t Resampler::getOutputLength(uint64_t in_frames) const {
+  return (in_frames * up + down - 1) / down;
+}
+
+uint64_t Resampler::getFirstSourceFrame(uint64_t position) const {
+  // Oldest source frame the output frame reads
+  uint64_t newest = getSourceFrame(position);
+
+  return newest >= taps - 1 ? newest - (taps - 1) : 0;
+}
+
+uint64_t Resampler::getSourceFrame(uint64_t position) const {
+  // Newest source frame the output frame reads
+  return (position * down + delay) / up;
+}
+
+uint32_t Resampler::process(const PCMSource &src, uint64_t position, float *dst, uint32_t frames) const {
+  uint32_t channel = src.getFormat().channel_count;
+  uint64_t src_frames = src.getFrameCount();
+  uint32_t missing = 0;
+
+  if (isIdentity()) {
+    uint32_t done = 0;
+
+    // Copy run by run across segments, silence past the end
+    while (done < frames) {
+      uint64_t available;
+      const float *in = src.getFrames(position + done, available);
+      uint32_t length = (uint32_t)(available < frames - done ? available : frames - done);
+
+      if (in == NULL) {
+        memset(dst + done * channel, 0, (frames - done) * channel * sizeof(float));
+
+        // Past the end is silence by design, only frames the source has count
+        if (position + done < src_frames) {
+          missing = (uint32_t)(src_frames - (position + done) < frames - done ? src_frames - (position + done) : frames - done);
+        }
+
+        break;
+      }
+
+      memcpy(dst + done * channel, in, length * channel * sizeof(float));
+      done += length;
+    }
+
+    return missing;
+  }
+
+  auto fir = Dispatch::kernels().fir;
+  const float *run = NULL;
+  uint64_t run_first = 0;
+  uint64_t run_frames = 0;
+
+  for (uint32_t j = 0; j < frames; j++) {
+    // Upsampled index of this output frame, shifted so group delay is zero
+    uint64_t u = (position + j) * down + delay;
+    int64_t oldest = (int64_t)(u / up) - taps + 1;
+    const float *h = coef.data() + (u % up) * taps;
+    float *out = dst + j * channel;
+
+    // Only the taps whose input index is inside the source
+    int64_t begin = oldest < 0 ? -oldest : 0;
+    int64_t end = (int64_t)src_frames - oldest < (int64_t)taps ? (int64_t)src_frames - oldest : taps;
+
+    if (begin >= end) {
+      memset(out, 0, channel * sizeof(float));
+      continue;
+    }
+
+    uint64_t first = (uint64_t)(oldest + begin);
+    uint64_t count = (uint64_t)(end - begin);
+
+    // Windows move forward slowly, look the segment up only when leaving it
+    if (run == NULL || first < run_first || first + count > run_first + run_frames) {
+      run = src.getFrames(first, run_frames);
+      run_first = first;
+
+      // One lookup per block as on the identity path, so the ring counts
+      // one miss. The rest is silence, counted up to the end of the source.
+      if (run == NULL) {
+        memset(out, 0, (frames - j) * channel * sizeof(float));
+
+        for (; j < frames && ((position + j) * down + delay) / up < src_frames + taps - 1; j++) {
+          missing++;
+        }
+
+        return missing;
+      }
+    }
+
+    fir(h + begin, run + (first - run_first) * channel, (uint32_t)count, channel, out);
+  }
+
+  return missing;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef _RESAMPLER_H_
+#define _RESAMPLER_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include "Buffer.h"
+
+#define RESAMPLER_TAPS        64      // taps per polyphase branch when upsampling
+#define RESAMPLER_CUTOFF      0.91    // -6dB point relative to the lower Nyquist
+
+// Bandlimited rational resampler (windowed-sinc polyphase). It holds no
+// history, every output frame is computed straight from the source buffer,
+// so the audio callback can start anywhere after a seek or stimulus switch.
+// A branch never spans more than SEGMENT_GUARD_FRAMES source frames, so its
+// input is always contiguous in a PCMBuffer. Frames the source doesn't have
+// (yet) come out as silence, process counts those inside the source.
+class Resampler {
+  private:
+    uint32_t up;
+    uint32_t down;
+    uint32_t taps;
+    uint64_t delay;           // filter center, in upsampled samples
+    std::vector<float> coef;  // [phase][tap]
+
+  public:
+    Resampler();
+
+    void setRatio(uint32_t, uint32_t);
+    bool isIdentity() const;
+
+    uint64_t getOutputLength(uint64_t) const;
+    uint64_t getFirstSourceFrame(uint64_t) const;
+    uint64_t getSourceFrame(uint64_t) const;
+    uint32_t process(const PCMSource &, uint64_t, float *, uint32_t) const;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "Spectrum.h"
+
+#include <QtGui/qpainter.h>
+#include <math.h>
+
+SpectrumWorker::SpectrumWorker(AudioTap *_pTap, QObject *parent)
+  : QThread(parent) {
+  pTap = _pTap;
+  fft_size = 4096;
+  bRunning = false;
+}
+
+void SpectrumWorker::setSize(uint32_t size) {
+  fft_size = size;
+}
+
+void SpectrumWorker::begin() {
+  // Raised before the thread exists, so a stop right after always clears it
+  bRunning = true;
+  start();
+}
+
+void SpectrumWorker::stop() {
+  bRunning = false;
+  wait();
+}
+
+void SpectrumWorker::run() {
+  SpectrumAnalyzer analyzer;
+  std::vector<char> raw;
+  std::vector<float> mono;
+  std::vector<float> result;
+  uint64_t last_position = 0;
+
+  while (bRunning) {
+    uint32_t rate, channel, samplesize;
+    uint32_t gen = pTap->getFormat(rate, channel, samplesize);
+
+    analyzer.setSize(fft_size);
+
+    if (rate > 0 && channel > 0 && samplesize > 0) {
+      uint32_t size = analyzer.getSize();
+      uint32_t frames = size / 2 * (SPECTRUM_AVERAGE_COUNT + 1);
+      uint32_t length = frames * channel * samplesize;
+      uint64_t position = 0;
+
+      raw.resize(length);
+      mono.resize(frames);
+
+      if (pTap->readLatest(raw.data(), length, position) == length && position != last_position) {
+        uint32_t check_rate, check_channel, check_samplesize;
+
+        // Format changed while we were copying
+        if (pTap->getFormat(check_rate, check_channel, check_samplesize) == gen) {
+          SpectrumAnalyzer::convertToMono(raw.data(), mono.data(), frames, channel, samplesize);
+          analyzer.analyze(mono.data(), frames, result);
+
+          emit spectrumReady(QVector<float>::fromStdVector(result), rate);
+        }
+
+        last_position = position;
+      }
+    }
+
+    msleep(SPECTRUM_INTERVAL_MS);
+  }
+}
+
+SpectrumWindow::SpectrumWindow(AudioTap *pTap, QWidget *parent)
+  : QWidget(parent, Qt::Window),
+    worker(pTap) {
+  samplingrate = 0;
+
+  setWindowTitle("Spectrum");
+  resize(800, 600);
+
+  sizeCombo = new QComboBox(this);
+  sizeCombo->move(10, 10);
+
+  for (uint32_t size = 1024; size <= 65536; size *= 2) {
+    sizeCombo->addItem(QString::number(size), size);
+  }
+
+  sizeCombo->setCurrentText("4096");
+
+  spectrogram = QImage(SPECTROGRAM_WIDTH, 256, QImage::Format_RGB32);
+  spectrogram.fill(Qt::black);
+
+  qRegisterMetaType<QVector<float>>("QVector<float>");
+
+  connect(sizeCombo, &QComboBox::currentTextChanged, [&](const QString &text) {
+    worker.setSize(text.toUInt());
+  });
+  connect(&worker, &SpectrumWorker::spectrumReady, this, &SpectrumWindow::updateSpectrum);
+}
+
+SpectrumWindow::~SpectrumWindow() {
+  worker.stop();
+}
+
+void SpectrumWindow::showEvent(QShowEvent *) {
+  if (!worker.isRunning()) {
+    worker.begin();
+  }
+}
+
+void SpectrumWindow::hideEvent(QHideEvent *) {
+  worker.stop();
+}
+
+QRectF SpectrumWindow::spectrumRect() {
+  return QRectF(50, 50, width() - 60, (height() - 60) * 0.55);
+}
+
+QRectF SpectrumWindow::spectrogramRect() {
+  QRectF upper = spectrumRect();
+
+  return QRectF(upper.left(), upper.bottom() + 10, upper.width(), height() - upper.bottom() - 20);
+}
+
+void SpectrumWindow::updateSpectrum(QVector<float> data, unsigned int rate) {
+  if (rate != samplingrate) {
+    spectrogram.fill(Qt::black);
+  }
+
+  spectrum = data;
+  samplingrate = rate;
+
+  // Scroll spectrogram one column and draw newest spectrum at right edge
+  int rows = spectrogram.height();
+  int bins = spectrum.size();
+
+  for (int y = 0; y < rows; y++) {
+    QRgb *line = (QRgb *)spectrogram.scanLine(y);
+
+    memmove(line, line + 1, (SPECTROGRAM_WIDTH - 1) * sizeof(QRgb));
+
+    // Linear frequency axis, top is Nyquist
+    int bin = (int)((int64_t)(rows - 1 - y) * (bins - 1) / (rows - 1));
+    float level = (spectrum.at(bin) - SPECTRUM_FLOOR_DB) / -SPECTRUM_FLOOR_DB;
+
+    level = fminf(fmaxf(level, 0.f), 1.f);
+    line[SPECTROGRAM_WIDTH - 1] = QColor::fromHsvF((1.f - level) * 0.7f, 1.f, level).rgb();
+  }
+
+  update();
+}
+
+void SpectrumWindow::paintEvent(QPaintEvent *) {
+  QPainter painter(this);
+  QRectF upper = spectrumRect();
+  QRectF lower = spectrogramRect();
+
+  painter.fillRect(rect(), Qt::white);
+  painter.fillRect(upper, Qt::black);
+  painter.drawImage(lower, spectrogram);
+
+  if (spectrum.size() < 2 || samplingrate == 0) {
+    return;
+  }
+
+  float nyquist = samplingrate / 2.f;
+  float min_freq = 10.f;
+
+  // Grid, log frequency axis
+  painter.setPen(Qt::darkGray);
+
+  for (float db = 0.f; db >= SPECTRUM_FLOOR_DB; db -= 20.f) {
+    float y = upper.top() + upper.height() * db / SPECTRUM_FLOOR_DB;
+
+    painter.drawLine(QPointF(upper.left(), y), QPointF(upper.right(), y));
+    painter.drawText(QPointF(5, y + 5), QString::number((int)db));
+  }
+
+  for (float freq = 100.f; freq < nyquist; freq *= 10.f) {
+    float x = upper.left() + upper.width() * log10f(freq / min_freq) / log10f(nyquist / min_freq);
+
+    painter.drawLine(QPointF(x, upper.top()), QPointF(x, upper.bottom()));
+    painter.drawText(QPointF(x + 2, upper.top() - 5), QString::number((int)freq));
+  }
+
+  painter.drawText(QPointF(upper.right() - 120, upper.top() - 5), QString("%1 Hz").arg(samplingrate));
+
+  // Spectrum
+  QPolygonF line;
+  int bins = spectrum.size();
+
+  for (int i = 1; i < bins; i++) {
+    float freq = nyquist * i / (bins - 1);
+    float x = upper.left() + upper.width() * log10f(fmaxf(freq, min_freq) / min_freq) / log10f(nyquist / min_freq);
+    float y = upper.top() + upper.height() * fminf(fmaxf(spectrum.at(i), SPECTRUM_FLOOR_DB), 0.f) / SPECTRUM_FLOOR_DB;
+
+    line.append(QPointF(x, y));
+  }
+
+  painter.setPen(Qt::green);
+  painter.drawPolyline(line);
+}
@@ -0,0 +1,65 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <QtCore/qthread.h>
+#include <QtCore/qvector.h>
+#include <QtGui/qimage.h>
+#include <QtWidgets/qwidget.h>
+#include <QtWidgets/qcombobox.h>
+#include <atomic>
+#include "Analyzer.h"
+
+#define SPECTRUM_FLOOR_DB             -150.f
+#define SPECTRUM_INTERVAL_MS          40
+#define SPECTROGRAM_WIDTH             512
+
+class SpectrumWorker : public QThread {
+  Q_OBJECT
+
+  private:
+    AudioTap *pTap;
+    std::atomic<uint32_t> fft_size;
+    std::atomic<bool> bRunning;
+
+  protected:
+    void run() override;
+
+  public:
+    SpectrumWorker(AudioTap *, QObject *parent = NULL);
+
+    void setSize(uint32_t);
+    void begin();
+    void stop();
+
+  signals:
+    void spectrumReady(QVector<float>, unsigned int);
+};
+
+class SpectrumWindow : public QWidget {
+  Q_OBJECT
+
+  private:
+    SpectrumWorker worker;
+    QComboBox *sizeCombo;
+
+    QVector<float> spectrum;
+    uint32_t samplingrate;
+    QImage spectrogram;
+
+    QRectF spectrumRect();
+    QRectF spectrogramRect();
+
+  protected:
+    void paintEvent(QPaintEvent *) override;
+    void showEvent(QShowEvent *) override;
+    void hideEvent(QHideEvent *) override;
+
+  public:
+    SpectrumWindow(AudioTap *, QWidget *parent = NULL);
+    ~SpectrumWindow();
+
+  public slots:
+    void updateSpectrum(QVector<float>, unsigned int);
+};
+
+#endif // SPECTRUM_H
@@ -0,0 +1,190 @@
+#include "Stimulus.h"
+#include "Buffer.h"
+
+#include <tuple>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+void StimulusKey::stamp() {
+  mtime = 0;
+  size = 0;
+
+#ifdef _WIN32
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  std::wstring wide((size_t)MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, NULL, 0), L'\0');
+
+  // Paths are UTF-8 as FFmpeg takes them
+  if (!wide.empty() && MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wide[0], (int)wide.size()) > 0 &&
+      GetFileAttributesExW(wide.c_str(), GetFileExInfoStandard, &data)) {
+    mtime = (int64_t)(((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime);
+    size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+  }
+#else
+  struct stat info;
+
+  if (stat(path.c_str(), &info) == 0) {
+    mtime = (int64_t)info.st_mtime;
+    size = (uint64_t)info.st_size;
+  }
+#endif
+}
+
+bool StimulusKey::operator<(const StimulusKey &other) const {
+  return std::tie(path, bTestingSamplerate, factor_hq, factor_lq, excerpt_start, excerpt_end, mtime, size) <
+         std::tie(other.path, other.bTestingSamplerate, other.factor_hq, other.factor_lq, other.excerpt_start, other.excerpt_end, other.mtime, other.size);
+}
+
+static size_t getPhysicalBytes() {
+#ifdef _WIN32
+  MEMORYSTATUSEX status;
+
+  status.dwLength = sizeof(status);
+
+  return GlobalMemoryStatusEx(&status) ? (size_t)status.ullTotalPhys : 0;
+#else
+  long pages = sysconf(_SC_PHYS_PAGES);
+
+  return pages > 0 ? (size_t)pages * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+StimulusStore::StimulusStore() {
+  const char *env = getenv(STORE_ENV);
+
+  budget = env ? (size_t)strtoull(env, NULL, 10) << 20 : STORE_DEFAULT_BUDGET;
+  high_water = (size_t)(getPhysicalBytes() * STORE_RSS_HIGH_WATER);
+}
+
+size_t StimulusStore::getBytes(const Stimulus &stimulus) {
+  return stimulus.hq.getBytes() + stimulus.lq.getBytes();
+}
+
+size_t StimulusStore::getResidentBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.WorkingSetSize;
+  }
+
+  return 0;
+#else
+  FILE *file = fopen("/proc/self/statm", "r");
+  unsigned long long pages = 0;
+  unsigned long long resident = 0;
+
+  if (file) {
+    if (fscanf(file, "%llu %llu", &pages, &resident) != 2) {
+      resident = 0;
+    }
+
+    fclose(file);
+  }
+
+  return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+std::shared_ptr<const Stimulus> StimulusStore::acquire(const StimulusKey &key, std::function<std::shared_ptr<const Stimulus>()> prepare) {
+  std::unique_lock<std::mutex> guard(lock);
+
+  // Songs every session has let go of leave expired entries behind
+  for (auto iter = entries.begin(); iter != entries.end();) {
+    iter = iter->second.expired() ? entries.erase(iter) : std::next(iter);
+  }
+
+  while (true) {
+    auto iter = entries.find(key);
+
+    if (iter != entries.end()) {
+      std::shared_ptr<const Stimulus> result = iter->second.lock();
+
+      if (result) {
+        hold(key, result);
+
+        return result;
+      }
+
+      entries.erase(iter);
+    }
+
+    if (pending.count(key) == 0) {
+      break;
+    }
+
+    // Another station is preparing it, take its result (or retry if it failed)
+    cond.wait(guard);
+  }
+
+  pending.insert(key);
+
+  // Room for the new song is made before it is decoded, not after
+  trim();
+  guard.unlock();
+
+  std::shared_ptr<const Stimulus> result = prepare();
+
+  guard.lock();
+  pending.erase(key);
+
+  if (result) {
+    entries[key] = result;
+    hold(key, result);
+    trim();
+  }
+
+  cond.notify_all();
+
+  return result;
+}
+
+void StimulusStore::hold(const StimulusKey &key, const std::shared_ptr<const Stimulus> &stimulus) {
+  auto iter = held_index.find(key);
+
+  if (iter != held_index.end()) {
+    held.splice(held.begin(), held, iter->second);
+  }
+  else {
+    held.push_front({ key, stimulus, getBytes(*stimulus) });
+    held_index[key] = held.begin();
+  }
+}
+
+void StimulusStore::trim() {
+  size_t resident = high_water ? getResidentBytes() : 0;
+  size_t excess = resident > high_water ? resident - high_water : 0;
+  size_t unused = 0;
+
+  // Free pool buffers are resident too and cheaper to give back than a song
+  if (excess > 0) {
+    size_t freed = PCMBufferPool::getInstance().trim(excess);
+
+    excess = excess > freed ? excess - freed : 0;
+  }
+
+  // Sessions let go without the lock, so what nobody uses is counted here
+  for (auto &item : held) {
+    unused += item.stimulus.use_count() == 1 ? item.bytes : 0;
+  }
+
+  // Dropping a stimulus a session still plays frees nothing, it stays
+  for (auto iter = held.end(); iter != held.begin() && (unused > budget || excess > 0);) {
+    --iter;
+
+    if (iter->stimulus.use_count() == 1) {
+      unused -= iter->bytes;
+      excess = excess > iter->bytes ? excess - iter->bytes : 0;
+      held_index.erase(iter->key);
+      iter = held.erase(iter);
+    }
+  }
+}
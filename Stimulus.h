@@ -0,0 +1,88 @@
+#pragma once
+
+#ifndef _STIMULUS_H_
+#define _STIMULUS_H_
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <stdint.h>
+
+#include "Codec.h"
+
+#define STORE_ENV               "LISTENING_TEST_CACHE_MB"   // budget for songs nobody plays
+#define STORE_DEFAULT_BUDGET    (1024ull << 20)
+#define STORE_RSS_HIGH_WATER    0.75                        // of physical memory
+
+// Rendered, loudness matched HQ and LQ versions of one song, compressed
+struct Stimulus {
+  CompressedPCM hq;
+  CompressedPCM lq;
+  double loudness_hq;
+  double loudness_lq;
+  double truepeak_hq;
+  double truepeak_lq;
+  uint64_t hash_hq;                     // xxHash64 of the float samples as stored
+  uint64_t hash_lq;
+};
+
+struct StimulusKey {
+  std::string path;
+  bool bTestingSamplerate;
+  uint32_t factor_hq;
+  uint32_t factor_lq;
+  uint32_t excerpt_start;
+  uint32_t excerpt_end;
+  int64_t mtime;                        // of the file, so an edited song isn't served stale
+  uint64_t size;
+
+  // Fills mtime and size from the file at path, zero if it can't be read
+  void stamp();
+
+  bool operator<(const StimulusKey &) const;
+};
+
+// Stimuli shared by every station of the process. Entries live as long as
+// some session holds them, a song used by several stations is prepared once
+// and stations asking while it is being prepared wait for that result.
+// Recently used stimuli are also kept after their sessions are gone, so going
+// back to a song is free. Those are evicted least recently used first, once
+// the ones no session uses exceed the budget or the process gets close to
+// running out of memory. Stimuli still in use are never counted or evicted.
+class StimulusStore {
+  private:
+    struct Held {
+      StimulusKey key;
+      std::shared_ptr<const Stimulus> stimulus;
+      size_t bytes;
+    };
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::map<StimulusKey, std::weak_ptr<const Stimulus>> entries;
+    std::set<StimulusKey> pending;
+
+    // Most recent first
+    std::list<Held> held;
+    std::map<StimulusKey, std::list<Held>::iterator> held_index;
+    size_t budget;
+    size_t high_water;
+
+    void hold(const StimulusKey &, const std::shared_ptr<const Stimulus> &);
+    void trim();
+
+  public:
+    StimulusStore();
+
+    std::shared_ptr<const Stimulus> acquire(const StimulusKey &, std::function<std::shared_ptr<const Stimulus>()>);
+
+    static size_t getBytes(const Stimulus &);
+    static size_t getResidentBytes();
+};
+
+#endif
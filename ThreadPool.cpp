@@ -0,0 +1,154 @@
+#include "ThreadPool.h"
+#include "Trace.h"
+
+thread_local int ThreadPool::current = -1;
+
+TaskGroup::TaskGroup() {
+  pending = 0;
+}
+
+bool TaskGroup::isDone() const {
+  return pending.load(std::memory_order_acquire) == 0;
+}
+
+ThreadPool::ThreadPool() {
+  // The thread which waits helps too, so one less worker than cores
+  uint32_t count = std::thread::hardware_concurrency();
+
+  count = count > 1 ? count - 1 : 1;
+
+  queued = 0;
+  next = 0;
+  bExit = false;
+
+  for (uint32_t i = 0; i < count; i++) {
+    queues.emplace_back(new Queue());
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    threads.emplace_back(&ThreadPool::workerMain, this, (int)i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(sleep_lock);
+
+    bExit = true;
+  }
+
+  sleep_cond.notify_all();
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+ThreadPool &ThreadPool::getInstance() {
+  static ThreadPool instance;
+
+  return instance;
+}
+
+uint32_t ThreadPool::getThreadCount() {
+  return (uint32_t)threads.size();
+}
+
+void ThreadPool::run(TaskGroup &group, std::function<void()> job) {
+  // Workers push to their own queue, other threads spread round robin
+  int index = current >= 0 ? current : (int)(next++ % queues.size());
+
+  group.pending++;
+
+  // Counted before it can be taken, so runOne never drops the count below zero
+  {
+    std::lock_guard<std::mutex> guard(sleep_lock);
+
+    queued++;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(queues[index]->lock);
+
+    queues[index]->tasks.push_back({ std::move(job), &group });
+  }
+
+  sleep_cond.notify_one();
+}
+
+bool ThreadPool::runOne(int self) {
+  Task task;
+  bool found = false;
+  int count = (int)queues.size();
+
+  // Own queue newest first, it is still in cache
+  if (self >= 0) {
+    std::lock_guard<std::mutex> guard(queues[self]->lock);
+
+    if (!queues[self]->tasks.empty()) {
+      task = std::move(queues[self]->tasks.back());
+      queues[self]->tasks.pop_back();
+      found = true;
+    }
+  }
+
+  // Steal the oldest task, which tends to be the largest piece of work left
+  for (int i = 1; i <= count && !found; i++) {
+    int victim = ((self >= 0 ? self : 0) + i) % count;
+    std::lock_guard<std::mutex> guard(queues[victim]->lock);
+
+    if (!queues[victim]->tasks.empty()) {
+      task = std::move(queues[victim]->tasks.front());
+      queues[victim]->tasks.pop_front();
+      found = true;
+    }
+  }
+
+  if (!found) {
+    return false;
+  }
+
+  queued--;
+  task.job();
+
+  // The last task of a group wakes whoever waits on it, the group may be
+  // gone right after the count drops
+  if (task.group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    std::lock_guard<std::mutex> guard(sleep_lock);
+
+    sleep_cond.notify_all();
+  }
+
+  return true;
+}
+
+void ThreadPool::wait(TaskGroup &group) {
+  while (!group.isDone()) {
+    if (runOne(current)) {
+      continue;
+    }
+
+    // Nothing to take while another thread runs the last tasks
+    std::unique_lock<std::mutex> guard(sleep_lock);
+
+    sleep_cond.wait(guard, [&]() { return group.isDone() || queued > 0; });
+  }
+}
+
+void ThreadPool::workerMain(int index) {
+  current = index;
+  Trace::setThreadName("pool worker");
+
+  while (true) {
+    if (runOne(index)) {
+      continue;
+    }
+
+    std::unique_lock<std::mutex> guard(sleep_lock);
+
+    sleep_cond.wait(guard, [&]() { return bExit || queued > 0; });
+
+    if (bExit) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+// Set of tasks which can be waited on together
+class TaskGroup {
+  friend class ThreadPool;
+
+  private:
+    std::atomic<uint32_t> pending;
+
+  public:
+    TaskGroup();
+
+    bool isDone() const;
+};
+
+// Process-wide work-stealing pool for offline rendering. Every thread owns a
+// queue and takes its newest task first, idle threads steal the oldest task
+// of another queue. Waiting threads run queued tasks and only sleep once
+// there is nothing left to take, so tasks may submit and wait on tasks of
+// their own.
+class ThreadPool {
+  private:
+    struct Task {
+      std::function<void()> job;
+      TaskGroup *group;
+    };
+
+    struct Queue {
+      std::mutex lock;
+      std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<uint32_t> queued;
+    std::atomic<uint32_t> next;
+    std::mutex sleep_lock;
+    std::condition_variable sleep_cond;
+    bool bExit;
+
+    static thread_local int current;
+
+    ThreadPool();
+    ~ThreadPool();
+
+    bool runOne(int);
+    void workerMain(int);
+
+  public:
+    static ThreadPool &getInstance();
+
+    void run(TaskGroup &, std::function<void()>);
+    void wait(TaskGroup &);
+    uint32_t getThreadCount();
+};
+
+#endif
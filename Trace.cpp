@@ -0,0 +1,110 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+std::atomic<bool> Trace::bEnabled(false);
+std::string Trace::path;
+std::mutex Trace::registry_lock;
+std::vector<std::shared_ptr<Trace::ThreadBuffer>> Trace::registry;
+
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+void Trace::init() {
+  const char *env = getenv(TRACE_ENV);
+
+  if (env && env[0]) {
+    path = env;
+    bEnabled = true;
+  }
+}
+
+uint64_t Trace::now() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+Trace::ThreadBuffer *Trace::getThreadBuffer() {
+  // Registry keeps the buffer after its thread exits, until the process ends
+  thread_local ThreadBuffer *buffer = NULL;
+
+  if (buffer == NULL) {
+    std::shared_ptr<ThreadBuffer> created = std::make_shared<ThreadBuffer>();
+    std::lock_guard<std::mutex> guard(registry_lock);
+
+    created->tid = (uint32_t)registry.size() + 1;
+    created->events.reserve(TRACE_THREAD_EVENTS);
+    created->dropped = 0;
+    registry.push_back(created);
+    buffer = created.get();
+  }
+
+  return buffer;
+}
+
+void Trace::record(const char *name, uint64_t begin, uint64_t end) {
+  ThreadBuffer *buffer = getThreadBuffer();
+  std::lock_guard<std::mutex> guard(buffer->lock);
+
+  // Never grows past the reservation, so recording doesn't allocate
+  if (buffer->events.size() < TRACE_THREAD_EVENTS) {
+    buffer->events.push_back({ name, begin, end });
+  }
+  else {
+    buffer->dropped++;
+  }
+}
+
+void Trace::setThreadName(const char *name) {
+  if (isEnabled()) {
+    ThreadBuffer *buffer = getThreadBuffer();
+    std::lock_guard<std::mutex> guard(buffer->lock);
+
+    buffer->name = name;
+  }
+}
+
+const std::string &Trace::getPath() {
+  return path;
+}
+
+bool Trace::dump(const std::string &target) {
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  FILE *file = fopen(target.c_str(), "w");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(registry_lock);
+
+    buffers = registry;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Listening_Test\"}}");
+
+  // Complete events, timestamps in microseconds
+  for (auto &buffer : buffers) {
+    std::lock_guard<std::mutex> guard(buffer->lock);
+
+    if (!buffer->name.empty()) {
+      fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", buffer->tid, buffer->name.c_str());
+    }
+
+    for (auto &event : buffer->events) {
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+              event.name, buffer->tid, event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+    }
+
+    if (buffer->dropped) {
+      fprintf(file, ",\n{\"name\":\"dropped %llu events\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+              (unsigned long long)buffer->dropped, buffer->tid, buffer->events.back().end / 1000.0);
+    }
+  }
+
+  fprintf(file, "\n]}\n");
+
+  return fclose(file) == 0;
+}
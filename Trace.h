@@ -0,0 +1,79 @@
+#pragma once
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define TRACE_ENV             "LISTENING_TEST_TRACE"   // output path, enables tracing
+#define TRACE_THREAD_EVENTS   16384                    // per thread, later events are dropped
+
+#define TRACE_CONCAT_(a, b)   a##b
+#define TRACE_CONCAT(a, b)    TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name)     TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+// Span recorder for the trial lifecycle, written as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev). Every thread records into its own
+// fixed size buffer, so a span costs two clock reads and an uncontended
+// lock. Disabled, a span is a single relaxed load. Names must be literals.
+class Trace {
+  private:
+    struct Event {
+      const char *name;
+      uint64_t begin;
+      uint64_t end;
+    };
+
+    struct ThreadBuffer {
+      std::mutex lock;
+      uint32_t tid;
+      std::string name;
+      std::vector<Event> events;
+      uint64_t dropped;
+    };
+
+    static std::atomic<bool> bEnabled;
+    static std::string path;
+    static std::mutex registry_lock;
+    static std::vector<std::shared_ptr<ThreadBuffer>> registry;
+
+    static ThreadBuffer *getThreadBuffer();
+
+  public:
+    static void init();
+    static inline bool isEnabled() {
+      return bEnabled.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t now();
+    static void record(const char *, uint64_t, uint64_t);
+    static void setThreadName(const char *);
+
+    static const std::string &getPath();
+    static bool dump(const std::string &);
+};
+
+class TraceScope {
+  private:
+    const char *name;
+    uint64_t begin;
+
+  public:
+    inline TraceScope(const char *_name) {
+      name = Trace::isEnabled() ? _name : NULL;
+      begin = name ? Trace::now() : 0;
+    }
+
+    inline ~TraceScope() {
+      if (name) {
+        Trace::record(name, begin, Trace::now());
+      }
+    }
+};
+
+#endif
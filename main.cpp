@@ -1,10 +1,35 @@
 #include "MainWindow.h"
 #include <QtWidgets/QApplication>
 
+#define STATION_ARGUMENT    "--stations"
+#define STATION_MAX         16
+
 int main(int argc, char *argv[])
 {
+    Trace::init();
+
     QApplication a(argc, argv);
-    MainWindow w;
-    w.show();
-    return a.exec();
+    AudioSystem audio;
+    std::vector<std::unique_ptr<MainWindow>> windows;
+    int stations = 1;
+
+    // One window per station, every station plays on its own output device
+    int option = a.arguments().indexOf(STATION_ARGUMENT);
+
+    if (option >= 0 && option + 1 < a.arguments().size()) {
+        stations = qBound(1, a.arguments().at(option + 1).toInt(), STATION_MAX);
+    }
+
+    for (int i = 0; i < stations; i++) {
+        windows.emplace_back(new MainWindow(audio, i, stations));
+        windows.back()->show();
+    }
+
+    int result = a.exec();
+
+    if (Trace::isEnabled()) {
+        Trace::dump(Trace::getPath());
+    }
+
+    return result;
 }